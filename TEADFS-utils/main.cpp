@@ -5,6 +5,14 @@
 #include "lib_tead_fs.h"
 
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
 #include <protocol.h>
 #include <memory.h>
 #include <linux/stat.h>
@@ -14,6 +22,7 @@
 #include <utime.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 
 #define DATA_EXTENSION_SIZE 32
 
@@ -26,6 +35,182 @@ struct TEAFS_DEAL_CB g_deal_db;
 
 int g_miscDev = 0;
 
+//directory paths sent with open and release when files are named by identity, by dir_id.
+//the least recently used are dropped past TEADFS_DIR_MAP_MAX, the kernel sends them again when asked
+#define TEADFS_DIR_MAP_MAX 4096
+std::mutex g_dirMutex;
+std::list<uint64_t> g_dirLru;
+std::unordered_map<uint64_t, std::pair<std::string, std::list<uint64_t>::iterator>> g_dirMap;
+
+//one-way notifies, dealt in arrival order by one pool thread at a time
+std::mutex g_notifyMutex;
+std::list<std::shared_ptr<std::string>> g_notifyList;
+bool g_bNotifyRunning = false;
+
+//extents of one message spread over the extent pool only when there are at least this many
+#define TEADFS_EXTENT_FANOUT_MIN 4
+
+//persistent workers helping with the extents of a message
+std::shared_ptr<TEAD::CThreadPool<std::function<void()>>> g_ptrExtentPool;
+
+//extents of one message, shared with helpers which may start after it is done
+struct TEADFS_EXTENT_STATE {
+	std::atomic<uint32_t> u32Next;
+	std::atomic<int> nRst;
+	std::mutex mutex;
+	std::condition_variable cond;
+	uint32_t u32Done;
+};
+
+static void extent_pool_cb_func(std::shared_ptr<std::function<void()>> ptr) {
+	(*ptr)();
+}
+
+//format 2, every extent of the data is transformed on its own, spread over the cores
+static int deal_teadfs_extents(bool bRead, uint8_t u8ExtentShift, const uint8_t* pIVSeed, uint32_t u32Flags
+	, uint64_t u64PlainOffset, uint32_t u32Size, char* pSrcData, char* pDstData) {
+	auto fnExtent = bRead ? g_deal_db.read_extent : g_deal_db.write_extent;
+	uint32_t u32ExtentSize = 1U << u8ExtentShift;
+	uint64_t u64First = u64PlainOffset >> u8ExtentShift;
+	uint32_t u32Count = (uint32_t)(((u64PlainOffset + u32Size + u32ExtentSize - 1) >> u8ExtentShift) - u64First);
+	auto ptrState = std::make_shared<TEADFS_EXTENT_STATE>();
+
+	ptrState->u32Next = 0;
+	ptrState->nRst = 1;
+	ptrState->u32Done = 0;
+	//a helper starting late finds no extent left and never touches the buffers
+	auto fnWorker = [=]() {
+		uint32_t i;
+		while ((i = ptrState->u32Next++) < u32Count) {
+			TEADFS_EXTENT extent;
+			uint64_t u64Start = std::max(u64PlainOffset, (u64First + i) << u8ExtentShift);
+			uint64_t u64End = std::min(u64PlainOffset + u32Size, (u64First + i + 1) << u8ExtentShift);
+			uint32_t u32Done = (uint32_t)(u64Start - u64PlainOffset);
+
+			extent.u64Extent = u64First + i;
+			extent.u32ExtentSize = u32ExtentSize;
+			extent.u32Offset = (uint32_t)(u64Start & (u32ExtentSize - 1));
+			extent.pIVSeed = pIVSeed;
+			extent.u32Flags = u32Flags;
+			if (fnExtent(&extent, (uint32_t)(u64End - u64Start), pSrcData + u32Done, pDstData + u32Done) < 0) {
+				ptrState->nRst = -1;
+			}
+			std::lock_guard<std::mutex> lock(ptrState->mutex);
+			if (++ptrState->u32Done == u32Count) {
+				ptrState->cond.notify_all();
+			}
+		}
+	};
+	//a few extents cost less than waking a helper
+	if (u32Count >= TEADFS_EXTENT_FANOUT_MIN && g_ptrExtentPool) {
+		uint32_t u32Workers = std::min(u32Count, std::max(1U, std::thread::hardware_concurrency()));
+		for (uint32_t i = 1; i < u32Workers; i++) {
+			g_ptrExtentPool->AddTask(std::make_shared<std::function<void()>>(fnWorker));
+		}
+	}
+	fnWorker();
+	std::unique_lock<std::mutex> lock(ptrState->mutex);
+	ptrState->cond.wait(lock, [&]() {
+		return ptrState->u32Done == u32Count;
+	});
+	return ptrState->nRst;
+}
+
+//a binary field lies within u32Size bytes from where its offset counts
+static bool teadfs_binary_fits(const teadfs_protocol_binary& binary, uint32_t u32Size) {
+	return binary.offset <= u32Size && binary.size <= u32Size - binary.offset;
+}
+
+//open the lower file the kernel granted with an upcall, -1 if none. the caller closes it
+static int take_teadfs_fd(uint64_t u64Token) {
+	if (!u64Token || g_miscDev < 0) {
+		return -1;
+	}
+	return ioctl(g_miscDev, TEADFS_IOC_TAKE_FD, &u64Token);
+}
+
+//directory id and path sent with an open or release, false if the message has none
+static bool get_teadfs_dir(teadfs_packet_info* pPacketInfo, uint64_t& u64DirId, std::string& strDirPath) {
+	teadfs_file_identity* pIdentity = nullptr;
+	if (PR_MSG_OPEN == pPacketInfo->header.msg_type) {
+		pIdentity = &pPacketInfo->data.open.identity;
+	} else if (PR_MSG_RELEASE == pPacketInfo->header.msg_type) {
+		pIdentity = &pPacketInfo->data.release.identity;
+	}
+	if (!pIdentity || !pIdentity->dir_id || !pIdentity->dir_path.size
+		|| !teadfs_binary_fits(pIdentity->dir_path, pPacketInfo->header.size)) {
+		return false;
+	}
+	u64DirId = pIdentity->dir_id;
+	strDirPath.assign((char*)pPacketInfo + pIdentity->dir_path.offset, pIdentity->dir_path.size);
+	return true;
+}
+
+//keep the directory path sent with an open or release, before the message is queued
+static void keep_teadfs_dir(teadfs_packet_info* pPacketInfo) {
+	uint64_t u64DirId = 0;
+	std::string strDirPath;
+	if (!get_teadfs_dir(pPacketInfo, u64DirId, strDirPath)) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(g_dirMutex);
+	auto it = g_dirMap.find(u64DirId);
+	if (g_dirMap.end() != it) {
+		it->second.first.swap(strDirPath);
+		g_dirLru.splice(g_dirLru.end(), g_dirLru, it->second.second);
+		return;
+	}
+	if (g_dirMap.size() >= TEADFS_DIR_MAP_MAX) {
+		g_dirMap.erase(g_dirLru.front());
+		g_dirLru.pop_front();
+	}
+	g_dirMap.emplace(u64DirId, std::make_pair(std::move(strDirPath), g_dirLru.insert(g_dirLru.end(), u64DirId)));
+}
+
+//full path of an open or release file. false if its directory is not known
+static bool get_teadfs_path(teadfs_packet_info* pPacketInfo, const teadfs_protocol_binary& filePath
+	, const teadfs_file_identity& identity, std::string& strFilePath) {
+	uint64_t u64DirId = 0;
+	std::string strDirPath;
+
+	if (!teadfs_binary_fits(filePath, pPacketInfo->header.size)) {
+		return false;
+	}
+	strFilePath.assign((char*)pPacketInfo + filePath.offset, filePath.size);
+	if (!identity.dir_id) {
+		return true;
+	}
+	//the message's own path, its map entry may be dropped already
+	if (!get_teadfs_dir(pPacketInfo, u64DirId, strDirPath)) {
+		std::lock_guard<std::mutex> lock(g_dirMutex);
+		auto it = g_dirMap.find(identity.dir_id);
+		if (g_dirMap.end() == it) {
+			return false;
+		}
+		g_dirLru.splice(g_dirLru.end(), g_dirLru, it->second.second);
+		strDirPath = it->second.first;
+	}
+	if (strDirPath.empty() || '/' != strDirPath.back()) {
+		strDirPath += '/';
+	}
+	strFilePath.insert(0, strDirPath);
+	return true;
+}
+
+//lower path of a granted fd, for a release whose directory was dropped
+static bool get_teadfs_fd_path(int nFd, std::string& strFilePath) {
+	char szLink[64];
+	char szPath[PATH_MAX];
+
+	snprintf(szLink, sizeof(szLink), "/proc/self/fd/%d", nFd);
+	ssize_t nSize = readlink(szLink, szPath, sizeof(szPath));
+	if (nSize <= 0 || nSize >= (ssize_t)sizeof(szPath)) {
+		return false;
+	}
+	strFilePath.assign(szPath, nSize);
+	return true;
+}
+
 static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 	teadfs_packet_info* pResponsePacketInfo;
 	int nRstSize = 0;
@@ -33,13 +218,29 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 
 	switch (pPacketInfo->header.msg_type) {
 	case PR_MSG_OPEN: {
-		int nCode;
+		int nCode = OFR_INIT;
 		std::string strFilePath;
-		strFilePath.resize(pPacketInfo->data.open.file_path.size + 1);
-		strFilePath.at(pPacketInfo->data.open.file_path.size) = '\0';
-		strFilePath.resize(pPacketInfo->data.open.file_path.size);
-		strFilePath.assign((char*)pPacketInfo + pPacketInfo->data.open.file_path.offset, pPacketInfo->data.open.file_path.size);
-		if (g_deal_db.open) {
+		if (!get_teadfs_path(pPacketInfo, pPacketInfo->data.open.file_path, pPacketInfo->data.open.identity, strFilePath)) {
+			//kernel sends the open again with the directory path
+			nCode = PR_OPEN_NEED_PATH;
+		} else if (g_deal_db.open_header && (pPacketInfo->data.open.header_flags & PR_OPEN_HEADER_VALID)) {
+			nCode = g_deal_db.open_header(pPacketInfo->data.open.file_id
+				, pPacketInfo->header.pid
+				, (char*)strFilePath.data()
+				, (char*)pPacketInfo + pPacketInfo->data.open.header.offset
+				, pPacketInfo->data.open.header.size
+			);
+		} else if (g_deal_db.open_fd) {
+			int nFd = take_teadfs_fd(pPacketInfo->data.open.fd_token);
+			nCode = g_deal_db.open_fd(pPacketInfo->data.open.file_id
+				, pPacketInfo->header.pid
+				, (char*)strFilePath.data()
+				, nFd
+			);
+			if (nFd >= 0) {
+				close(nFd);
+			}
+		} else if (g_deal_db.open) {
 			nCode = g_deal_db.open(pPacketInfo->data.open.file_id
 				, pPacketInfo->header.pid
 				, (char*)strFilePath.data()
@@ -52,18 +253,28 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 	}
 		break;
 	case PR_MSG_RELEASE: {
-		int nCode;
+		int nCode = TRFR_NORMAL;
 		std::string strFilePath;
-		strFilePath.resize(pPacketInfo->data.open.file_path.size + 1);
-		strFilePath.at(pPacketInfo->data.open.file_path.size) = '\0';
-		strFilePath.resize(pPacketInfo->data.open.file_path.size);
-		strFilePath.assign((char*)pPacketInfo + pPacketInfo->data.open.file_path.offset, pPacketInfo->data.open.file_path.size);
-		if (g_deal_db.release) {
+		int nFd = g_deal_db.release_fd ? take_teadfs_fd(pPacketInfo->data.release.fd_token) : -1;
+		if (!get_teadfs_path(pPacketInfo, pPacketInfo->data.release.file_path, pPacketInfo->data.release.identity, strFilePath)
+			&& (nFd < 0 || !get_teadfs_fd_path(nFd, strFilePath))) {
+			//directory dropped or never announced, nothing to name the file by
+			printf("release of unknown directory %llu\n", (unsigned long long)pPacketInfo->data.release.identity.dir_id);
+		} else if (g_deal_db.release_fd) {
+			nCode = g_deal_db.release_fd(pPacketInfo->data.release.file_id
+				, pPacketInfo->header.pid
+				, (char*)strFilePath.data()
+				, nFd
+			);
+		} else if (g_deal_db.release) {
 			nCode = g_deal_db.release(pPacketInfo->data.release.file_id
 				, pPacketInfo->header.pid
 				, (char*)strFilePath.data()
 			);
 		}
+		if (nFd >= 0) {
+			close(nFd);
+		}
 		binResponseData.resize(sizeof(teadfs_packet_info));
 		pResponsePacketInfo = (teadfs_packet_info*)binResponseData.data();
 		pResponsePacketInfo->header = pPacketInfo->header;
@@ -73,8 +284,20 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 	case PR_MSG_READ: {
 		std::string binDstData;
 		uint32_t nDstSize = pPacketInfo->data.write.write_data.size + DATA_EXTENSION_SIZE;
+		int nCode = 0;
 		binDstData.resize(nDstSize);
-		if (g_deal_db.read) g_deal_db.read(pPacketInfo->data.read.offset
+		if (pPacketInfo->data.read.extent_shift && g_deal_db.read_extent) {
+			//read offsets are in the lower file, extents count from the end of the label
+			nDstSize = pPacketInfo->data.read.read_data.size;
+			if (deal_teadfs_extents(true, pPacketInfo->data.read.extent_shift, pPacketInfo->data.read.iv_seed
+				, pPacketInfo->data.read.compress ? TEADFS_EXTENT_COMPRESSED : 0
+				, pPacketInfo->data.read.offset - ENCRYPT_FILE_HEADER_SIZE
+				, nDstSize
+				, (char*)pPacketInfo + pPacketInfo->data.read.read_data.offset
+				, (char*)binDstData.data()) < 0) {
+				nCode = -1;
+			}
+		} else if (g_deal_db.read) g_deal_db.read(pPacketInfo->data.read.offset
 			, pPacketInfo->data.read.read_data.size
 			, (char*)pPacketInfo + pPacketInfo->data.read.read_data.offset
 			, &nDstSize
@@ -83,7 +306,7 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 		binResponseData.resize(sizeof(teadfs_packet_info) + nDstSize);
 		pResponsePacketInfo = (teadfs_packet_info*)binResponseData.data();
 		pResponsePacketInfo->header = pPacketInfo->header;
-		pResponsePacketInfo->data.read.code = 0;
+		pResponsePacketInfo->data.read.code = nCode;
 		pResponsePacketInfo->data.read.read_data.size = nDstSize;
 		pResponsePacketInfo->data.read.read_data.offset = sizeof(teadfs_packet_info);
 		memcpy((char *)binResponseData.data() + sizeof(teadfs_packet_info), binDstData.data(), nDstSize);
@@ -92,8 +315,37 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 	case PR_MSG_WRITE: {
 		std::string binDstData;
 		uint32_t nDstSize = pPacketInfo->data.write.write_data.size + DATA_EXTENSION_SIZE;
+		int nCode = 0;
 		binDstData.resize(nDstSize);
-		if (g_deal_db.write) g_deal_db.write(pPacketInfo->data.write.offset
+		if (pPacketInfo->data.write.compress && g_deal_db.compress_extent) {
+			//one whole extent, stored in fewer bytes when it compresses
+			TEADFS_EXTENT extent;
+			extent.u32ExtentSize = 1U << pPacketInfo->data.write.extent_shift;
+			extent.u64Extent = pPacketInfo->data.write.offset >> pPacketInfo->data.write.extent_shift;
+			extent.u32Offset = 0;
+			extent.pIVSeed = pPacketInfo->data.write.iv_seed;
+			extent.u32Flags = TEADFS_EXTENT_COMPRESSED;
+			nDstSize = pPacketInfo->data.write.write_data.size;
+			if (g_deal_db.compress_extent(&extent
+				, pPacketInfo->data.write.write_data.size
+				, (char*)pPacketInfo + pPacketInfo->data.write.write_data.offset
+				, &nDstSize
+				, (char*)binDstData.data()) < 0
+				|| nDstSize > pPacketInfo->data.write.write_data.size) {
+				nCode = -1;
+				nDstSize = 0;
+			}
+		} else if (pPacketInfo->data.write.extent_shift && g_deal_db.write_extent) {
+			nDstSize = pPacketInfo->data.write.write_data.size;
+			if (deal_teadfs_extents(false, pPacketInfo->data.write.extent_shift, pPacketInfo->data.write.iv_seed
+				, pPacketInfo->data.write.compress ? TEADFS_EXTENT_COMPRESSED : 0
+				, pPacketInfo->data.write.offset
+				, nDstSize
+				, (char*)pPacketInfo + pPacketInfo->data.write.write_data.offset
+				, (char*)binDstData.data()) < 0) {
+				nCode = -1;
+			}
+		} else if (g_deal_db.write) g_deal_db.write(pPacketInfo->data.write.offset
 			, pPacketInfo->data.write.write_data.size,
 			(char*)pPacketInfo + pPacketInfo->data.write.write_data.offset
 			, &nDstSize
@@ -102,7 +354,7 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 		binResponseData.resize(sizeof(teadfs_packet_info) + nDstSize);
 		pResponsePacketInfo = (teadfs_packet_info*)binResponseData.data();
 		pResponsePacketInfo->header = pPacketInfo->header;
-		pResponsePacketInfo->data.write.code = 0;
+		pResponsePacketInfo->data.write.code = nCode;
 		pResponsePacketInfo->data.write.write_data.size = nDstSize;
 		pResponsePacketInfo->data.write.write_data.offset = sizeof(teadfs_packet_info);
 		memcpy((char *)binResponseData.data() + sizeof(teadfs_packet_info), binDstData.data(), nDstSize);
@@ -111,18 +363,99 @@ static void deal_teadfs_msg(teadfs_packet_info* pPacketInfo) {
 	case PR_MSG_CLEANUP:
 		if (g_deal_db.cleanup) g_deal_db.cleanup(pPacketInfo->data.cleanup.file_id);
 		break;
+	case PR_MSG_EVENT: {
+		uint32_t nOffset = pPacketInfo->data.event.events.offset;
+		uint32_t nEnd = nOffset + pPacketInfo->data.event.events.size;
+		if (nEnd > pPacketInfo->header.size) {
+			break;
+		}
+		for (uint32_t i = 0; i < pPacketInfo->data.event.count; i++) {
+			teadfs_event_record* pRecord = (teadfs_event_record*)((char*)pPacketInfo + nOffset);
+			if ((nOffset + sizeof(teadfs_event_record) > nEnd) || (pRecord->size < sizeof(teadfs_event_record))
+				|| (nOffset + pRecord->size > nEnd)
+				|| !teadfs_binary_fits(pRecord->file_path, pRecord->size)
+				|| !teadfs_binary_fits(pRecord->new_file_path, pRecord->size)) {
+				break;
+			}
+			std::string strFilePath((char*)pRecord + pRecord->file_path.offset, pRecord->file_path.size);
+			std::string strNewFilePath((char*)pRecord + pRecord->new_file_path.offset, pRecord->new_file_path.size);
+			if (g_deal_db.event) g_deal_db.event(pRecord->event
+				, pRecord->ino
+				, (char*)strFilePath.c_str()
+				, (char*)strNewFilePath.c_str()
+			);
+			nOffset += pRecord->size;
+		}
+	}
+		break;
+	case PR_MSG_STAT: {
+		uint32_t nOffset = pPacketInfo->data.stat.stats.offset;
+		uint32_t nEnd = nOffset + pPacketInfo->data.stat.stats.size;
+		//answered in place
+		binResponseData.assign((char*)pPacketInfo, pPacketInfo->header.size);
+		pResponsePacketInfo = (teadfs_packet_info*)binResponseData.data();
+		if (nEnd > pPacketInfo->header.size) {
+			break;
+		}
+		for (uint32_t i = 0; i < pPacketInfo->data.stat.count; i++) {
+			teadfs_stat_record* pRecord = (teadfs_stat_record*)((char*)pResponsePacketInfo + nOffset);
+			if ((nOffset + sizeof(teadfs_stat_record) > nEnd) || (pRecord->size < sizeof(teadfs_stat_record))
+				|| (nOffset + pRecord->size > nEnd)
+				|| !teadfs_binary_fits(pRecord->file_path, pRecord->size)) {
+				break;
+			}
+			std::string strFilePath((char*)pRecord + pRecord->file_path.offset, pRecord->file_path.size);
+			int64_t i64PlainSize = -1;
+			//0 leaves the file unanswered, getattr asks its open verdict then
+			int nCode = 0;
+			if (g_deal_db.stat) {
+				nCode = g_deal_db.stat(pRecord->ino
+					, pPacketInfo->header.pid
+					, (char*)strFilePath.c_str()
+					, pRecord->lower_size
+					, &i64PlainSize
+				);
+			}
+			pRecord->access = nCode;
+			pRecord->plain_size = i64PlainSize;
+			nOffset += pRecord->size;
+		}
+	}
+		break;
 	default:
 		break;
 	}
+	//one-way msg, kernel not wait answer
+	if (pPacketInfo->header.flags & PR_FLAG_NO_REPLY) {
+		return;
+	}
 	g_ptrNetlink->SendMsg(binResponseData.size(), binResponseData.data());
 }
 
+static void deal_teadfs_notify() {
+	while (1) {
+		std::shared_ptr<std::string> ptr;
+		{
+			std::lock_guard<std::mutex> lock(g_notifyMutex);
+			if (g_notifyList.empty()) {
+				g_bNotifyRunning = false;
+				return;
+			}
+			ptr = g_notifyList.front();
+			g_notifyList.pop_front();
+		}
+		deal_teadfs_msg((teadfs_packet_info*)ptr->data());
+	}
+}
+
 static void thread_pool_cb_func(std::shared_ptr<std::string> ptr) {
 	printf("dddd\n");
 	teadfs_packet_info* pPacketInfo = (teadfs_packet_info*)ptr->data();
 	//user mode request kernel
 	if (1 == pPacketInfo->header.initiator) {
 		CRequestInfo::ResponseMsg(pPacketInfo->header.msg_id, ptr);
+	} else if (pPacketInfo->header.flags & PR_FLAG_NO_REPLY) {
+		deal_teadfs_notify();
 	} else {
 		deal_teadfs_msg(pPacketInfo);
 	}
@@ -130,15 +463,41 @@ static void thread_pool_cb_func(std::shared_ptr<std::string> ptr) {
 }
 
 void netlink_rcv_cb_func(std::shared_ptr<std::string> ptr) {
-	g_ptrThreadPool->AddTask(ptr);
+	teadfs_packet_info* pPacketInfo = (teadfs_packet_info*)ptr->data();
+	//in arrival order, a file may be handled before the message naming its directory
+	if (0 == pPacketInfo->header.initiator) {
+		keep_teadfs_dir(pPacketInfo);
+	}
+	//keep one-way notifies in kernel order
+	if (0 == pPacketInfo->header.initiator && (pPacketInfo->header.flags & PR_FLAG_NO_REPLY)) {
+		bool bStart = false;
+		{
+			std::lock_guard<std::mutex> lock(g_notifyMutex);
+			g_notifyList.push_back(ptr);
+			if (!g_bNotifyRunning) {
+				g_bNotifyRunning = true;
+				bStart = true;
+			}
+		}
+		if (bStart) {
+			g_ptrThreadPool->AddTask(ptr);
+		}
+		return;
+	}
+	//verdicts an opener waits on go before queued data transforms
+	g_ptrThreadPool->AddTask(ptr, 0 == pPacketInfo->header.initiator && PR_PRIO_META == pPacketInfo->header.priority);
 }
 
-int StartTEADFS(struct TEAFS_DEAL_CB cb) {
+int StartTEADFSSession(struct TEAFS_DEAL_CB cb, uint32_t u32Session) {
 	int nRst = 0;
 	// set deal function
 	g_deal_db = cb;
 	// start thead pool. and set thread pool callback
 	g_ptrThreadPool = std::make_shared<TEAD::CThreadPool<std::string>>(thread_pool_cb_func);
+	//format 2 extents of a message are transformed on their own pool
+	if (cb.read_extent || cb.write_extent) {
+		g_ptrExtentPool = std::make_shared<TEAD::CThreadPool<std::function<void()>>>(extent_pool_cb_func);
+	}
 
 	g_miscDev = open("/dev/teadfs", O_RDONLY);
 	if (g_miscDev < 0) {
@@ -152,7 +511,13 @@ int StartTEADFS(struct TEAFS_DEAL_CB cb) {
 	}
 	//send hello to kernel
 	CRequestInfo requestInfo(g_ptrNetlink);
-	requestInfo.SendHello(nullptr);
+	requestInfo.SendHello(u32Session, (cb.open_fd ? PR_HELLO_OPEN_FD : 0)
+		| (cb.release_fd ? PR_HELLO_RELEASE_FD : 0)
+		| ((cb.u32Options & TEADFS_OPTION_IDENTITY) ? PR_HELLO_IDENTITY : 0), nullptr);
 
 	return 1;
+}
+
+int StartTEADFS(struct TEAFS_DEAL_CB cb) {
+	return StartTEADFSSession(cb, 0);
 }
\ No newline at end of file
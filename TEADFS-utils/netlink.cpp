@@ -1,5 +1,6 @@
 #include "netlink.h"
 
+#include <protocol.h>
 #include <memory.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -8,8 +9,6 @@
 
 #define NETLINK_TEADFS 25
 
-#define MAX_MSG_SIZE (8 * 1024)
-
 CNetlinkInfo::CNetlinkInfo() {
     //
     m_skfd = -1;
@@ -115,9 +114,9 @@ void CNetlinkInfo::ThreadRcv() {
             if (!ptrMsg) {
                 continue;
             }
-            struct nlmsghdr* nlh = (struct nlmsghdr*)malloc(NLMSG_SPACE(MAX_MSG_SIZE));
+            struct nlmsghdr* nlh = (struct nlmsghdr*)malloc(NLMSG_SPACE(TEADFS_MSG_MAX_SIZE));
             memset(nlh, 0, sizeof(struct nlmsghdr));
-            nlh->nlmsg_len = NLMSG_SPACE(MAX_MSG_SIZE);
+            nlh->nlmsg_len = NLMSG_SPACE(TEADFS_MSG_MAX_SIZE);
             nlh->nlmsg_flags = 0;
             nlh->nlmsg_type = 0;
             nlh->nlmsg_seq = 0;
@@ -32,7 +32,7 @@ uint64_t get_next_msg_id() {
 }
 
 
-int CRequestInfo::SendHello(response_handler handler) {
+int CRequestInfo::SendHello(uint32_t u32Session, uint32_t u32Features, response_handler handler) {
 	
 	std::shared_ptr<std::string> ptrBuf = std::make_shared<std::string>();
 	ptrBuf->resize(sizeof(teadfs_packet_info));
@@ -45,6 +45,8 @@ int CRequestInfo::SendHello(response_handler handler) {
 	p_packet_info->header.initiator = 1;
 
 	p_packet_info->data.hello.pid = getpid();
+	p_packet_info->data.hello.session = u32Session;
+	p_packet_info->data.hello.features = u32Features;
 
 	{
 		std::lock_guard<std::mutex> lock(s_mutex);
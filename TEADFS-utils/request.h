@@ -19,7 +19,7 @@ public:
 	~CRequestInfo();
 
 public:
-	int SendHello(response_handler handler);
+	int SendHello(uint32_t u32Session, uint32_t u32Features, response_handler handler);
 
 	static void ResponseMsg(uint64_t u64, std::shared_ptr<std::string> ptr);
 private:
@@ -4,6 +4,7 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <functional>
 
 namespace TEAD {
 
@@ -27,7 +28,8 @@ namespace TEAD {
 	class CTaskList {
 	public:
 
-		void Push(std::shared_ptr<T> ptr);
+		//bUrgent tasks are popped before the others
+		void Push(std::shared_ptr<T> ptr, bool bUrgent = false);
 
 		std::shared_ptr<T> Pop();
 
@@ -36,6 +38,7 @@ namespace TEAD {
 		std::mutex m_mutex;
 		//list
 		std::list<std::shared_ptr<T>> m_list;
+		std::list<std::shared_ptr<T>> m_urgentList;
 	};
 
 
@@ -82,8 +85,8 @@ namespace TEAD {
 			CThreadPool(handler handle);
 			virtual ~CThreadPool();
 
-			//add task to thread pool
-			void AddTask(std::shared_ptr<T> ptr);
+			//add task to thread pool, bUrgent tasks run first
+			void AddTask(std::shared_ptr<T> ptr, bool bUrgent = false);
 
 			//thread run main
 			void Runnable();
@@ -106,10 +109,14 @@ namespace TEAD {
 
 	/////////////////////////////////////////////////////////////TaskList///////////////////////////////////////////////////////////////////////////////
 	template<class T>
-	void CTaskList<T>::Push(std::shared_ptr<T> ptr) {
+	void CTaskList<T>::Push(std::shared_ptr<T> ptr, bool bUrgent) {
 		std::lock_guard<std::mutex> lock(m_mutex);
 
-		m_list.push_back(ptr);
+		if (bUrgent) {
+			m_urgentList.push_back(ptr);
+		} else {
+			m_list.push_back(ptr);
+		}
 		return;
 	}
 
@@ -117,6 +124,11 @@ namespace TEAD {
 	std::shared_ptr<T> CTaskList<T>::Pop() {
 		std::lock_guard<std::mutex> lock(m_mutex);
 
+		if (!m_urgentList.empty()) {
+			auto ptr = m_urgentList.front();
+			m_urgentList.pop_front();
+			return ptr;
+		}
 		if (m_list.empty()) {
 			return nullptr;
 		}
@@ -222,8 +234,8 @@ namespace TEAD {
 	}
 
 	template<class T>
-	void CThreadPool<T>::AddTask(std::shared_ptr<T> ptr) {
-		m_task.Push(ptr);
+	void CThreadPool<T>::AddTask(std::shared_ptr<T> ptr, bool bUrgent) {
+		m_task.Push(ptr, bUrgent);
 		neosmart::SetEvent(m_event);
 	}
 
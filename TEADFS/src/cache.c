@@ -0,0 +1,215 @@
+#include "cache.h"
+#include "teadfs_header.h"
+#include "teadfs_log.h"
+#include "stats.h"
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/shrinker.h>
+#include <linux/workqueue.h>
+
+/*
+ * Decrypted pages live in i_decrypt next to the ciphertext in the lower
+ * page cache, so a decrypted file is cached twice. The inode_list of the
+ * mount is kept in i_decrypt use order, the head is the coldest inode.
+ * Both the decrypt_budget trimming and the shrinker drop i_decrypt pages
+ * from the head on.
+ */
+
+unsigned long teadfs_decrypt_cache_pages(struct super_block* sb) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(sb);
+	struct teadfs_inode_info* inode_info;
+	unsigned long pages = 0;
+
+	spin_lock(&sbi->inode_list_lock);
+	list_for_each_entry(inode_info, &sbi->inode_list, sb_list) {
+		pages += inode_info->i_decrypt.nrpages;
+	}
+	spin_unlock(&sbi->inode_list_lock);
+	return pages;
+}
+
+static void teadfs_decrypt_pages_sub(struct teadfs_sb_info* sbi, unsigned long pages) {
+	//reclaim drops pages unseen, the count may already be lower
+	if (atomic_long_sub_return(pages, &sbi->decrypt_pages) < 0)
+		atomic_long_set(&sbi->decrypt_pages, 0);
+}
+
+void teadfs_decrypt_cache_dropped(struct super_block* sb, unsigned long pages) {
+	teadfs_decrypt_pages_sub(teadfs_get_super_block(sb), pages);
+}
+
+/**
+ * teadfs_decrypt_evict
+ * @sb: The teadfs super block
+ * @nr_to_scan: Pages to drop
+ * @writeback: Write dirty pages first, not from reclaim
+ *
+ * Drops clean, unmapped i_decrypt pages of the coldest inodes until
+ * @nr_to_scan are gone or every inode was visited. Visited inodes go to
+ * the tail, so the walk restarts from the head each time the lock was
+ * dropped without seeing one twice.
+ *
+ * Returns the number of pages dropped
+ */
+static unsigned long teadfs_decrypt_evict(struct super_block* sb, unsigned long nr_to_scan, int writeback) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(sb);
+	struct teadfs_inode_info* inode_info;
+	struct inode* inode, *toput_inode = NULL;
+	struct list_head* pos;
+	unsigned long nr_inodes = 0;
+	unsigned long before;
+	unsigned long freed = 0;
+	//pages left in the visited inodes, the new count after a full pass
+	unsigned long left = 0;
+
+	spin_lock(&sbi->inode_list_lock);
+	list_for_each(pos, &sbi->inode_list)
+		nr_inodes++;
+	while (nr_inodes && freed < nr_to_scan) {
+		nr_inodes--;
+		inode_info = list_first_entry(&sbi->inode_list, struct teadfs_inode_info, sb_list);
+		list_move_tail(&inode_info->sb_list, &sbi->inode_list);
+		if (!inode_info->i_decrypt.nrpages)
+			continue;
+		//inodes being freed are skipped
+		inode = igrab(&inode_info->vfs_inode);
+		if (!inode) {
+			left += inode_info->i_decrypt.nrpages;
+			continue;
+		}
+		spin_unlock(&sbi->inode_list_lock);
+
+		before = inode_info->i_decrypt.nrpages;
+		if (writeback)
+			filemap_write_and_wait(&inode_info->i_decrypt);
+		invalidate_mapping_pages(&inode_info->i_decrypt, 0, -1);
+		if (before > inode_info->i_decrypt.nrpages)
+			freed += before - inode_info->i_decrypt.nrpages;
+		left += inode_info->i_decrypt.nrpages;
+
+		//our reference keeps inode_info on the list
+		iput(toput_inode);
+		toput_inode = inode;
+		spin_lock(&sbi->inode_list_lock);
+	}
+	spin_unlock(&sbi->inode_list_lock);
+	iput(toput_inode);
+	if (nr_inodes)
+		teadfs_decrypt_pages_sub(sbi, freed);
+	else
+		atomic_long_set(&sbi->decrypt_pages, left);
+	return freed;
+}
+
+static void teadfs_decrypt_trim_work(struct work_struct* work) {
+	struct teadfs_sb_info* sbi = container_of(work, struct teadfs_sb_info, decrypt_trim_work);
+	struct super_block* sb = sbi->sb;
+	unsigned long budget = sbi->opts.decrypt_budget;
+	unsigned long pages;
+	unsigned long freed;
+
+	LOG_DBG("ENTRY\n");
+	do {
+		pages = teadfs_decrypt_cache_pages(sb);
+		atomic_long_set(&sbi->decrypt_pages, pages);
+		if (!budget || pages <= budget)
+			break;
+		//trim below the budget, not to come back after a few pages
+		freed = teadfs_decrypt_evict(sb, pages - budget + budget / 8, 1);
+		teadfs_stats_add(sb, TS_DECRYPT_TRIM, freed);
+		LOG_DBG("pages:%lu, budget:%lu, freed:%lu\n", pages, budget, freed);
+	} while (0);
+	LOG_DBG("LEVAL\n");
+}
+
+void teadfs_decrypt_cache_touch(struct inode* inode) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(inode->i_sb);
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+
+	atomic_long_inc(&sbi->decrypt_pages);
+	//a jiffy is fine for the order, most pages of a read skip the lock
+	if (ACCESS_ONCE(inode_info->decrypt_touched) != jiffies
+		&& ACCESS_ONCE(sbi->inode_list.prev) != &inode_info->sb_list) {
+		spin_lock(&sbi->inode_list_lock);
+		list_move_tail(&inode_info->sb_list, &sbi->inode_list);
+		inode_info->decrypt_touched = jiffies;
+		spin_unlock(&sbi->inode_list_lock);
+	}
+
+	if (atomic_inc_return(&sbi->decrypt_added) < TEADFS_DECRYPT_CHECK_PAGES)
+		return;
+	atomic_set(&sbi->decrypt_added, 0);
+	schedule_work(&sbi->decrypt_trim_work);
+}
+
+#if defined(CONFIG_SHRINKER_COUNT_SCAN)
+static unsigned long teadfs_decrypt_count(struct shrinker* shrink, struct shrink_control* sc) {
+	struct teadfs_sb_info* sbi = container_of(shrink, struct teadfs_sb_info, decrypt_shrinker);
+
+	return (atomic_long_read(&sbi->decrypt_pages) / 100) * sysctl_vfs_cache_pressure;
+}
+
+static unsigned long teadfs_decrypt_scan(struct shrinker* shrink, struct shrink_control* sc) {
+	struct teadfs_sb_info* sbi = container_of(shrink, struct teadfs_sb_info, decrypt_shrinker);
+	unsigned long freed;
+
+	//invalidation may write the inode back
+	if (!(sc->gfp_mask & __GFP_FS))
+		return SHRINK_STOP;
+	freed = teadfs_decrypt_evict(sbi->sb, sc->nr_to_scan, 0);
+	teadfs_stats_add(sbi->sb, TS_DECRYPT_SHRINK, freed);
+	return freed;
+}
+#else
+static int teadfs_decrypt_shrink(struct shrinker* shrink, struct shrink_control* sc) {
+	struct teadfs_sb_info* sbi = container_of(shrink, struct teadfs_sb_info, decrypt_shrinker);
+
+	if (sc->nr_to_scan) {
+		//invalidation may write the inode back
+		if (!(sc->gfp_mask & __GFP_FS))
+			return -1;
+		teadfs_stats_add(sbi->sb, TS_DECRYPT_SHRINK,
+			teadfs_decrypt_evict(sbi->sb, sc->nr_to_scan, 0));
+	}
+	return (atomic_long_read(&sbi->decrypt_pages) / 100) * sysctl_vfs_cache_pressure;
+}
+#endif
+
+int teadfs_decrypt_cache_create(struct super_block* sb) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(sb);
+	int rc = 0;
+
+	LOG_DBG("ENTRY\n");
+	do {
+		sbi->sb = sb;
+		atomic_set(&sbi->decrypt_added, 0);
+		atomic_long_set(&sbi->decrypt_pages, 0);
+		INIT_WORK(&sbi->decrypt_trim_work, teadfs_decrypt_trim_work);
+		sbi->decrypt_shrinker.seeks = DEFAULT_SEEKS;
+#if defined(CONFIG_SHRINKER_COUNT_SCAN)
+		sbi->decrypt_shrinker.count_objects = teadfs_decrypt_count;
+		sbi->decrypt_shrinker.scan_objects = teadfs_decrypt_scan;
+		rc = register_shrinker(&sbi->decrypt_shrinker);
+		if (rc)
+			break;
+#else
+		sbi->decrypt_shrinker.shrink = teadfs_decrypt_shrink;
+		register_shrinker(&sbi->decrypt_shrinker);
+#endif
+		sbi->decrypt_cache_ready = 1;
+	} while (0);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+void teadfs_decrypt_cache_destroy(struct super_block* sb) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(sb);
+
+	if (!sbi || !sbi->decrypt_cache_ready)
+		return;
+	unregister_shrinker(&sbi->decrypt_shrinker);
+	cancel_work_sync(&sbi->decrypt_trim_work);
+	sbi->decrypt_cache_ready = 0;
+}
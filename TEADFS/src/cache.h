@@ -0,0 +1,24 @@
+#ifndef __CACHE_H___
+#define __CACHE_H___
+
+#include <linux/fs.h>
+
+//pages added to i_decrypt between two checks of the decrypt_budget and resyncs of the count
+#define TEADFS_DECRYPT_CHECK_PAGES 64
+
+//register the decrypt page shrinker of the mount
+int teadfs_decrypt_cache_create(struct super_block* sb);
+
+//unregister shrinker and wait for trimming. before the inodes go
+void teadfs_decrypt_cache_destroy(struct super_block* sb);
+
+//a page was read into i_decrypt of inode, it becomes the hottest
+void teadfs_decrypt_cache_touch(struct inode* inode);
+
+//pages in the i_decrypt mappings of the mount, walks every inode
+unsigned long teadfs_decrypt_cache_pages(struct super_block* sb);
+
+//pages of an i_decrypt mapping are about to be dropped outside the shrinker
+void teadfs_decrypt_cache_dropped(struct super_block* sb, unsigned long pages);
+
+#endif
@@ -37,5 +37,17 @@
 #define CONFIG_INDOE_HAS_IO_LIST
 #endif
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(4, 0, 0)
+#define CONFIG_VM_REMAP_PAGES
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 12, 0)
+#define CONFIG_SHRINKER_COUNT_SCAN
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+#define CONFIG_GET_MM_EXE_FILE
+#endif
+
 
 #endif // !CONFIG_H
@@ -46,37 +46,55 @@
  * dcache. Most filesystems leave this as NULL, because all their
  * dentries in the dcache are valid.
  *
+ * In rcu-walk the lower path is read locklessly and the lower
+ * d_revalidate gets LOOKUP_RCU too, it returns -ECHILD itself if it
+ * needs ref-walk. Attributes are only copied in ref-walk. A lower dentry
+ * replaced behind teadfs is no longer hashed, the name is looked up again.
+ *
  * Returns 1 if valid, 0 otherwise.
  *
  */
 static int teadfs_d_revalidate(struct dentry *dentry, unsigned int flags)
 {
 	struct dentry *lower_dentry = NULL;
+	struct teadfs_dentry_info* dentry_info;
+	struct inode* inode;
 	int rc = 1;
 	struct path lower_path;
 
 	do {
-		if (flags & LOOKUP_RCU) {
-			rc = -ECHILD;
+		//d_release may clear it under rcu-walk, load it once
+		dentry_info = ACCESS_ONCE(dentry->d_fsdata);
+		if (!dentry_info) {
+			rc = (flags & LOOKUP_RCU) ? -ECHILD : 0;
 			break;
 		}
-		teadfs_get_lower_path(dentry, &lower_path);
+		teadfs_info_lower_path(dentry_info, &lower_path);
 		lower_dentry = lower_path.dentry;
+		if (!lower_dentry) {
+			rc = (flags & LOOKUP_RCU) ? -ECHILD : 0;
+			break;
+		}
+		//renamed over or unlinked in the lower directory, the daemon labels files so
+		if (d_unhashed(lower_dentry)) {
+			rc = 0;
+			break;
+		}
 		if (!lower_dentry->d_op || !lower_dentry->d_op->d_revalidate)
 			break;
 
-		LOG_DBG("ENTRY\n");
 		rc = lower_dentry->d_op->d_revalidate(lower_dentry, flags);
-		if (dentry->d_inode) {
+		if (flags & LOOKUP_RCU)
+			break;
+
+		LOG_DBG("LEVAL rc : [%d]\n", rc);
+		inode = dentry->d_inode;
+		if (inode) {
 			struct inode* lower_inode =
-				teadfs_inode_to_lower(dentry->d_inode);
+				teadfs_inode_to_lower(inode);
 
-			fsstack_copy_attr_all(dentry->d_inode, lower_inode);
+			fsstack_copy_attr_all(inode, lower_inode);
 		}
-		if (lower_dentry) {
-			teadfs_put_lower_path(dentry, &lower_path);
-		}
-		LOG_DBG("LEVAL rc : [%d]\n", rc);
 	} while (0);
 	return rc;
 }
@@ -86,23 +104,23 @@ static int teadfs_d_revalidate(struct dentry *dentry, unsigned int flags)
  * teadfs_d_release
  * @dentry: The ecryptfs dentry
  *
- * Called when a dentry is really deallocated.
+ * Called when a dentry is really deallocated. rcu-walk may still read
+ * the private data, so it is freed after a grace period.
  */
 static void teadfs_d_release(struct dentry *dentry)
 {
 	struct path lower_path;
-	struct dentry* lower_dentry;
+	struct teadfs_dentry_info* dentry_info = teadfs_dentry_to_private(dentry);
 
 	LOG_DBG("ENTRY name:%s\n", dentry->d_name.name);
-	if (teadfs_dentry_to_private(dentry)) {
+	if (dentry_info) {
 		teadfs_get_lower_path(dentry, &lower_path);
-		lower_dentry = lower_path.dentry;
 		dput(lower_path.dentry);
 		mntput(lower_path.mnt);
 		teadfs_put_lower_path(dentry, &lower_path);
 
-		teadfs_free(teadfs_dentry_to_private(dentry));
 		teadfs_set_dentry_private(dentry, NULL);
+		kfree_rcu(dentry_info, rcu);
 	}
 	LOG_DBG("LEVAL\n");
 	return;
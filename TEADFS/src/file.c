@@ -31,6 +31,7 @@
 #include "config.h"
 #include "user_com.h"
 #include "global_param.h"
+#include "mmap.h"
 
 #include <linux/fs.h>
 #include <linux/file.h>
@@ -42,6 +43,9 @@
 #include <linux/compat.h>
 #include <linux/fs_stack.h>
 #include <linux/aio.h>
+#include <linux/falloc.h>
+#include <linux/namei.h>
+#include <linux/sched.h>
 
 
 void teadfs_replace_copy_address_space(struct inode* inode, struct address_space* dst_address_space, struct address_space* src_address_space) {
@@ -69,7 +73,7 @@ struct file* teadfs_get_lower_file(struct dentry* dentry, struct inode* inode, i
 	teadfs_get_lower_path(dentry, &lower_path);
 	//teadfs client not lock
 	kpid = task_tgid_vnr(current);
-	if (kpid == teadfs_get_client_pid()) {
+	if (kpid == teadfs_get_client_pid(teadfs_sb_session(dentry->d_sb))) {
 		kpid = 0;
 	}
 	//
@@ -107,7 +111,7 @@ void teadfs_put_lower_file(struct inode* inode, struct file* file)
 	
 	//teadfs client not lock
 	kpid = task_tgid_vnr(current);
-	if (kpid == teadfs_get_client_pid()) {
+	if (kpid == teadfs_get_client_pid(teadfs_sb_session(file_inode(file)->i_sb))) {
 		kpid = 0;
 	}
 	//
@@ -127,14 +131,16 @@ void teadfs_put_lower_file(struct inode* inode, struct file* file)
 				path_put(&(lower_file->f_path));
 			}
 			if (S_ISREG(inode->i_mode)) {
-				//send to user mode
+				//user mode may label the file on release, forget verdicts of it unlabeled
+				teadfs_drop_open_verdicts(inode);
+				//queue release notify to user mode, close not wait it
 				teadfs_request_release(teadfs_file_to_private(file)->file_path, teadfs_file_to_private(file)->file_path_length, file);
 			}
 			mutex_unlock(&inode_info->lower_file_mutex);
 		}
 		teadfs_put_lower_path(dentry, &lower_path);
 	} else {
-		LOG_INF("filemap_write_and_wait r\n");
+		LOG_DBG("filemap_write_and_wait r\n");
 		if (inode) {
 			filemap_write_and_wait(file->f_mapping);
 		}
@@ -145,6 +151,14 @@ void teadfs_put_lower_file(struct inode* inode, struct file* file)
 }
 
 
+//passthrough mount option, plain files skip the upper page cache
+static int teadfs_is_passthrough(struct file* file) {
+	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
+
+	return teadfs_get_super_block(file_inode(file)->i_sb)->opts.passthrough
+		&& OFR_INIT == file_info->access;
+}
+
 /**
  * teadfs_aio_read_update_atime
  * 
@@ -164,6 +178,7 @@ static ssize_t teadfs_aio_read_update_atime(struct kiocb *iocb,
 	struct path lower_path;
 	struct file *file = iocb->ki_filp;
 	struct teadfs_file_info *file_info  = teadfs_file_to_private(file);
+	loff_t lower_pos = pos;
 
 	LOG_DBG("ENTRY file:%px\n", file);
 	do {
@@ -171,6 +186,30 @@ static ssize_t teadfs_aio_read_update_atime(struct kiocb *iocb,
 		// invalidate page
 		//invalidate_remote_inode(lower_file->f_inode);
 		//invalidate_remote_inode(file->f_inode);
+		//decrypt view ends before i_size, generic direct read would fall back to the page cache at eof
+		if ((file->f_flags & O_DIRECT) && OFR_DECRYPT == file_info->access) {
+			rc = filemap_write_and_wait_range(file->f_mapping, pos, pos + iov_length(iov, nr_segs) - 1);
+			if (!rc) {
+				rc = teadfs_direct_IO(READ, iocb, iov, pos, nr_segs);
+			}
+			if (rc > 0) {
+				iocb->ki_pos = pos + rc;
+				touch_atime(&lower_path);
+			}
+			break;
+		}
+		if (teadfs_is_passthrough(file)) {
+			//pages dirtied through mmap go first
+			rc = filemap_write_and_wait(file->f_mapping);
+			if (!rc) {
+				rc = teadfs_lower_rw(READ, file_info->lower_file, iov, nr_segs, &lower_pos);
+			}
+			if (rc > 0) {
+				iocb->ki_pos = lower_pos;
+				fsstack_copy_attr_atime(file_inode(file), file_inode(file_info->lower_file));
+			}
+			break;
+		}
 		//read
 		rc = generic_file_aio_read(iocb, iov, nr_segs, pos);
 		/*
@@ -200,18 +239,39 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 	struct file* file = iocb->ki_filp;
 	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
 	struct dentry* dentry = file->f_path.dentry;
+	struct inode* inode = file_inode(file);
+	loff_t lower_pos = pos;
 
-	LOG_INF("ENTRY file:%px name:%s\n", file, dentry->d_name.name);
+	LOG_DBG("ENTRY file:%px name:%s\n", file, dentry->d_name.name);
 	do {
 
-		//write
-		rc = generic_file_aio_write(iocb, iov, nr_segs, pos);
-		/*
-		 * Even though this is a async interface, we need to wait
-		 * for IO to finish to update atime
-		 */
-		if (-EIOCBQUEUED == rc)
-			rc = wait_on_sync_kiocb(iocb);
+		if (teadfs_is_passthrough(file)) {
+			rc = teadfs_lower_rw(WRITE, file_info->lower_file, iov, nr_segs, &lower_pos);
+			if (rc > 0) {
+				iocb->ki_pos = lower_pos;
+				fsstack_copy_inode_size(inode, file_inode(file_info->lower_file));
+				fsstack_copy_attr_times(inode, file_inode(file_info->lower_file));
+				//clean cached pages are stale now
+				invalidate_remote_inode(inode);
+			}
+		} else {
+			//write
+			rc = generic_file_aio_write(iocb, iov, nr_segs, pos);
+			/*
+			 * Even though this is a async interface, we need to wait
+			 * for IO to finish to update atime
+			 */
+			if (-EIOCBQUEUED == rc)
+				rc = wait_on_sync_kiocb(iocb);
+		}
+
+		//tell user mode the file content changed, once per open
+		if (rc > 0 && !file_info->written) {
+			file_info->written = 1;
+			teadfs_get_lower_path(dentry, &lower);
+			teadfs_notify_event(TET_WRITE, file_inode(file), &lower, NULL);
+			teadfs_put_lower_path(dentry, &lower);
+		}
 
 		// double buffer, encrypte data forbide edit.  decrypt data edit, must invalidate encrypt/decrypt data page
 		if (OFR_DECRYPT == file_info->access) {
@@ -227,6 +287,15 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 
 #if defined(CONFIG_ITERATE_DIR)
 #else
+	//names of one readdir call looked up by readdirplus
+	#define TEADFS_READDIRPLUS_BATCH 32
+
+	struct teadfs_readdirplus {
+		int count;
+		int name_len[TEADFS_READDIRPLUS_BATCH];
+		char name[TEADFS_READDIRPLUS_BATCH][NAME_MAX + 1];
+	};
+
 	#if defined(RHEL_RELEASE)
 		struct teadfs_getdents_callback {
 			struct dir_context ctx;
@@ -235,6 +304,8 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 			filldir_t filldir;
 			int filldir_called;
 			int entries_written;
+			//NULL without the readdirplus mount option
+			struct teadfs_readdirplus* plus;
 		};
 	#else
 		struct teadfs_getdents_callback {
@@ -243,6 +314,8 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 			filldir_t filldir;
 			int filldir_called;
 			int entries_written;
+			//NULL without the readdirplus mount option
+			struct teadfs_readdirplus* plus;
 		};
 	#endif 
     
@@ -262,11 +335,91 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 		rc = buf->filldir(buf->dirent, lower_name, lower_namelen, offset, ino, d_type);
 		if (rc >= 0)
 			buf->entries_written++;
+		//remember names the caller got, "." and ".." are not prefetched
+		if (rc >= 0 && buf->plus && buf->plus->count < TEADFS_READDIRPLUS_BATCH
+			&& lower_namelen <= NAME_MAX
+			&& !(lower_name[0] == '.' && (lower_namelen == 1
+				|| (lower_namelen == 2 && lower_name[1] == '.')))) {
+			memcpy(buf->plus->name[buf->plus->count], lower_name, lower_namelen);
+			buf->plus->name_len[buf->plus->count] = lower_namelen;
+			buf->plus->count++;
+		}
 
 		LOG_DBG("LEVAL rc [:%d]\n", rc);
 		return rc;
 	}
 
+	/**
+	 * teadfs_readdirplus
+	 * @file: The directory being listed, its i_mutex is held
+	 * @plus: Names just returned by readdir
+	 *
+	 * Instantiates the child dentries and inodes, so the stat calls that
+	 * usually follow a listing find them cached. Regular files without a
+	 * fresh answer are resolved by one PR_MSG_STAT upcall for the chunk.
+	 * The client's verdict depends on the caller, so only stat calls of the
+	 * listing process use the answers.
+	 */
+	static void teadfs_readdirplus(struct file* file, struct teadfs_readdirplus* plus)
+	{
+		struct dentry* dir = file->f_path.dentry;
+		struct teadfs_sb_info* sbi = teadfs_get_super_block(dir->d_sb);
+		struct teadfs_stat_entry* entries;
+		struct teadfs_inode_info* inode_info;
+		struct inode* inode;
+		struct dentry* child;
+		struct pid* old_pid;
+		loff_t lower_size;
+		loff_t size;
+		int count = 0;
+		int i;
+
+		LOG_DBG("ENTRY count:%d\n", plus->count);
+		entries = teadfs_zalloc(plus->count * sizeof(struct teadfs_stat_entry), GFP_KERNEL);
+		if (!entries)
+			return;
+		for (i = 0; i < plus->count; i++) {
+			child = lookup_one_len(plus->name[i], dir, plus->name_len[i]);
+			if (IS_ERR(child))
+				continue;
+			inode = child->d_inode;
+			if (!inode || !S_ISREG(inode->i_mode)) {
+				dput(child);
+				continue;
+			}
+			lower_size = i_size_read(teadfs_inode_to_lower(inode));
+			if (teadfs_prefetched_size(inode, lower_size, &size)) {
+				dput(child);
+				continue;
+			}
+			entries[count].inode = inode;
+			entries[count].path.mnt = file->f_path.mnt;
+			entries[count].path.dentry = child;
+			entries[count].lower_size = lower_size;
+			count++;
+		}
+		if (count && !teadfs_request_stat(dir->d_sb, entries, count)) {
+			for (i = 0; i < count; i++) {
+				inode = entries[i].inode;
+				inode_info = teadfs_inode_to_private(inode);
+				spin_lock(&inode->i_lock);
+				old_pid = inode_info->attr_pid;
+				inode_info->attr_pid = get_pid(task_tgid(current));
+				inode_info->attr_access = entries[i].access;
+				inode_info->attr_plain_size = entries[i].plain_size;
+				inode_info->attr_lower_size = entries[i].lower_size;
+				inode_info->attr_expires = jiffies + msecs_to_jiffies(sbi->opts.readdirplus);
+				spin_unlock(&inode->i_lock);
+				put_pid(old_pid);
+			}
+		}
+		for (i = 0; i < count; i++) {
+			dput(entries[i].path.dentry);
+		}
+		teadfs_free(entries);
+		LOG_DBG("LEVAL count:%d\n", count);
+	}
+
 #endif
 
 /**
@@ -298,9 +451,11 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 #if defined(CONFIG_ITERATE_DIR)
 		rc = iterate_dir(lower_file, ctx);
 #else
+		memset(&buf, 0, sizeof(buf));
+		if (teadfs_get_super_block(inode->i_sb)->opts.readdirplus)
+			buf.plus = teadfs_zalloc(sizeof(struct teadfs_readdirplus), GFP_KERNEL);
 		//centos 7.5 kernel must use iterate_dir
 	#if defined(RHEL_RELEASE)
-		memset(&buf, 0, sizeof(buf));
 		buf.dirent = dirent;
 		buf.dentry = file->f_path.dentry;
 		buf.filldir = filldir;
@@ -309,7 +464,6 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 		buf.ctx.actor = teadfs_filldir;
 		rc = iterate_dir(lower_file, &buf.ctx);
 	#else
-			memset(&buf, 0, sizeof(buf));
 			buf.dirent = dirent;
 			buf.dentry = file->f_path.dentry;
 			buf.filldir = filldir;
@@ -321,12 +475,22 @@ static ssize_t teadfs_aio_write(struct kiocb* iocb,
 		file->f_pos = lower_file->f_pos;
 		if (rc < 0)
 			break;
+#if defined(CONFIG_ITERATE_DIR)
+#else
+		if (buf.plus && buf.plus->count)
+			teadfs_readdirplus(file, buf.plus);
+#endif
 		if (buf.filldir_called && !buf.entries_written)
 			break;
 		if (rc >= 0)
 			fsstack_copy_attr_atime(inode,
 				file_inode(lower_file));
 	} while (0);
+#if defined(CONFIG_ITERATE_DIR)
+#else
+	if (buf.plus)
+		teadfs_free(buf.plus);
+#endif
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
@@ -346,6 +510,56 @@ static struct teadfs_kthread_ctl {
 	wait_queue_head_t wait;
 } teadfs_kthread_ctl;
 
+/**
+ * teadfs_read_file_header
+ * @inode: The teadfs inode
+ * @lower_file: The lower file, opened for an OFR_DECRYPT verdict
+ *
+ * Record the extent layout of a format 2 or 3 label in the inode. Labels
+ * of format 1, or of a format above the format= mount option, leave the
+ * inode on the byte stream transform.
+ *
+ * Returns zero on success; -EIO on a bad format 2 label
+ */
+int teadfs_read_file_header(struct inode* inode, struct file* lower_file)
+{
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	struct teadfs_file_header header;
+	int rc = 0;
+
+	LOG_DBG("ENTRY\n");
+	do {
+		memset(&header, 0, sizeof(header));
+		if (teadfs_get_super_block(inode->i_sb)->opts.format < TEADFS_FORMAT_V2)
+			break;
+		rc = kernel_read(lower_file, 0, (char*)&header, sizeof(header));
+		if (rc < 0)
+			break;
+		rc = 0;
+		if ((TEADFS_FORMAT_V2 != header.version && TEADFS_FORMAT_V3 != header.version)
+			|| header.version > teadfs_get_super_block(inode->i_sb)->opts.format) {
+			header.version = 0;
+			header.extent_shift = 0;
+			break;
+		}
+		if (header.extent_shift < TEADFS_EXTENT_SHIFT_MIN
+			|| header.extent_shift > TEADFS_EXTENT_SHIFT_MAX) {
+			LOG_ERR("bad extent shift:%u\n", header.extent_shift);
+			rc = -EIO;
+			break;
+		}
+	} while (0);
+	if (!rc) {
+		mutex_lock(&inode_info->lower_file_mutex);
+		inode_info->extent_shift = header.extent_shift;
+		memcpy(inode_info->iv_seed, header.iv_seed, sizeof(inode_info->iv_seed));
+		inode_info->extent_compress = (TEADFS_FORMAT_V3 == header.version);
+		mutex_unlock(&inode_info->lower_file_mutex);
+	}
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
 /**
  * teadfs_open
  * @inode: inode speciying file to open
@@ -378,10 +592,12 @@ static int teadfs_open(struct inode *inode, struct file *file)
 			break;
 		}
 		file_info->lower_file = NULL;
+		file_info->file_id = teadfs_get_next_msg_id();
 		file_info->access = access;
 		file_info->file_path = NULL;
 		file_info->file_path_buf = NULL;
 		file_info->file_path_length = 0;
+		file_info->written = 0;
 		//update inode file access
 		mutex_lock(&inode_info->lower_file_mutex);
 		inode_info->file_decrypt = ((OFR_ENCRYPT == access) ? 1 : ((OFR_DECRYPT == access) ? 1 : 0)); 
@@ -395,6 +611,10 @@ static int teadfs_open(struct inode *inode, struct file *file)
 		}
 		//check file flag
 		flags |= file->f_flags;
+		//header shifts the lower offsets, direct io is done through bounce buffers
+		if (OFR_DECRYPT == access) {
+			flags &= ~O_DIRECT;
+		}
 		//only write will not support in mmap to read file. so add read
 		if ((flags & O_ACCMODE) == O_WRONLY) {
 			flags ^= O_WRONLY;
@@ -406,7 +626,16 @@ static int teadfs_open(struct inode *inode, struct file *file)
 			LOG_ERR("dentry_open Error rc=%d\n", rc);
 			break;
 		}
+		if (OFR_DECRYPT == access) {
+			rc = teadfs_read_file_header(inode, file_info->lower_file);
+			if (rc) {
+				teadfs_put_lower_file(inode, file);
+				break;
+			}
+		}
 		file_info->access = access;
+		//ra_pages mount option, the bdi is shared on older kernels
+		file->f_ra.ra_pages = teadfs_get_super_block(inode->i_sb)->opts.ra_pages;
 		if (OFR_DECRYPT == file_info->access) {
 			teadfs_replace_copy_address_space(inode, &(inode_info->i_decrypt), file->f_mapping);
 			file->f_mapping = &(inode_info->i_decrypt);
@@ -424,6 +653,45 @@ static int teadfs_open(struct inode *inode, struct file *file)
 	return rc;
 }
 
+/**
+ * teadfs_mmap
+ * @file: The teadfs file being mapped
+ * @vma: The new mapping
+ *
+ * Pages of a shared writable mapping are written back after the file
+ * may be closed, so each such vma holds the lower file in vm_private_data
+ * and the inode keeps one for writeback until the last of them is closed.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+static int teadfs_mmap(struct file* file, struct vm_area_struct* vma)
+{
+	int rc = 0;
+	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(file_inode(file));
+
+	LOG_DBG("ENTRY file:%px\n", file);
+	do {
+		rc = generic_file_mmap(file, vma);
+		if (rc) {
+			break;
+		}
+		vma->vm_ops = &teadfs_file_vm_ops;
+		if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE)
+			&& OFR_ENCRYPT != file_info->access) {
+			vma->vm_private_data = get_file(file_info->lower_file);
+			mutex_lock(&inode_info->lower_file_mutex);
+			if (!inode_info->mmap_lower_file) {
+				inode_info->mmap_lower_file = get_file(file_info->lower_file);
+			}
+			inode_info->mmap_count++;
+			mutex_unlock(&inode_info->lower_file_mutex);
+		}
+	} while (0);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
 static int teadfs_flush(struct file* file, fl_owner_t td)
 {
 	struct file* lower_file = teadfs_file_to_lower(file);
@@ -447,6 +715,14 @@ static int teadfs_release(struct inode *inode, struct file *file)
 	LOG_INF("ENTRY file:%px name:%s\n", file, dentry->d_name.name);
 	if (file_info) {
 		LOG_DBG("ENTRY file:%px lower_file:%px\n", file, file_info->lower_file);
+		//lower_nocache, drop the ciphertext pages left behind by writeback
+		if (OFR_DECRYPT == file_info->access && file_info->lower_file
+			&& teadfs_get_super_block(inode->i_sb)->opts.lower_nocache) {
+			filemap_write_and_wait(file->f_mapping);
+			filemap_write_and_wait(file_info->lower_file->f_mapping);
+			teadfs_stats_add(inode->i_sb, TS_LOWER_DROP,
+				invalidate_mapping_pages(file_info->lower_file->f_mapping, 0, -1));
+		}
 		teadfs_put_lower_file(inode, file);
 		//release memory
 		if (file_info->file_path_buf) {
@@ -462,16 +738,140 @@ static int teadfs_release(struct inode *inode, struct file *file)
 }
 
 
+/**
+ * teadfs_file_llseek
+ *
+ * SEEK_HOLE and SEEK_DATA are answered by the lower file, which knows
+ * the allocation. The decrypt view is shifted by the header.
+ */
 static loff_t teadfs_file_llseek(struct file* file, loff_t offset, int whence) {
 	loff_t rc;
+	loff_t header = 0;
 	struct dentry* dentry = file->f_path.dentry;
+	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
 
 	LOG_DBG("ENTRY file:%px offset:%lld  whence:%d name:%s\n", file, offset, whence, dentry->d_name.name);
 	do {
-		rc = generic_file_llseek(file, offset, whence);
+		//slots of compressed extents end in holes that are data above
+		if ((SEEK_HOLE != whence && SEEK_DATA != whence)
+			|| !file_info || !file_info->lower_file
+			|| teadfs_inode_to_private(file_inode(file))->extent_compress) {
+			rc = generic_file_llseek(file, offset, whence);
+			break;
+		}
+		if (offset < 0) {
+			rc = -ENXIO;
+			break;
+		}
+		//dirty pages are not allocated below yet
+		rc = filemap_write_and_wait(file->f_mapping);
+		if (rc)
+			break;
+		if (OFR_DECRYPT == file_info->access)
+			header = ENCRYPT_FILE_HEADER_SIZE;
+		rc = vfs_llseek(file_info->lower_file, offset + header, whence);
+		if (rc < 0)
+			break;
+		rc -= header;
+		spin_lock(&file->f_lock);
+		if (rc != file->f_pos) {
+			file->f_pos = rc;
+			file->f_version = 0;
+		}
+		spin_unlock(&file->f_lock);
 	} while (0);
+	LOG_DBG("LEVAL rc : [%lld]\n", rc);
 	return rc;
 }
+/**
+ * teadfs_fallocate
+ * @file: The teadfs file
+ * @mode: FALLOC_FL_* flags
+ * @offset: Start of the range in the upper file
+ * @len: Length of the range
+ *
+ * Forwards the request to the lower file, behind the header for the
+ * decrypt view. The decrypt view only preallocates within the file, a
+ * punched, zeroed or grown range would read back zero ciphertext. Upper
+ * pages of punched or zeroed ranges are written back first and dropped
+ * after, so the cache reads the new lower content.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+static long teadfs_fallocate(struct file* file, int mode, loff_t offset, loff_t len)
+{
+	long rc = 0;
+	struct inode* inode = file_inode(file);
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
+	struct file* lower_file;
+	struct inode* lower_inode;
+	loff_t lower_offset = offset;
+	loff_t old_size;
+	int drop_cache = mode & FALLOC_FL_PUNCH_HOLE;
+
+	LOG_DBG("ENTRY offset:%lld, len:%lld, mode:0x%x\n", offset, len, mode);
+#ifdef FALLOC_FL_ZERO_RANGE
+	drop_cache |= mode & FALLOC_FL_ZERO_RANGE;
+#endif
+	mutex_lock(&inode->i_mutex);
+	do {
+		if (!file_info || !file_info->lower_file) {
+			rc = -EIO;
+			break;
+		}
+		lower_file = file_info->lower_file;
+		lower_inode = file_inode(lower_file);
+		//the ciphertext view is read only, as in teadfs_write_lower
+		if (OFR_ENCRYPT == file_info->access) {
+			rc = -EIO;
+			break;
+		}
+		if (!lower_file->f_op || !lower_file->f_op->fallocate) {
+			rc = -EOPNOTSUPP;
+			break;
+		}
+		//a compressed extent is rewritten whole, never punched in part
+		if (inode_info->extent_compress && (mode & ~FALLOC_FL_KEEP_SIZE)) {
+			rc = -EOPNOTSUPP;
+			break;
+		}
+		if (OFR_DECRYPT == file_info->access) {
+			lower_offset += ENCRYPT_FILE_HEADER_SIZE;
+			//zeros below are not the ciphertext of zeros, only allocation within the file keeps it readable
+			if (drop_cache || (!(mode & FALLOC_FL_KEEP_SIZE) && lower_offset + len > i_size_read(lower_inode))) {
+				rc = -EOPNOTSUPP;
+				break;
+			}
+		}
+		if (drop_cache) {
+			rc = filemap_write_and_wait_range(&inode->i_data, lower_offset, lower_offset + len - 1);
+			if (!rc)
+				rc = filemap_write_and_wait_range(&inode_info->i_decrypt, offset, offset + len - 1);
+			if (rc)
+				break;
+		}
+		old_size = i_size_read(lower_inode);
+		sb_start_write(lower_inode->i_sb);
+		rc = lower_file->f_op->fallocate(lower_file, mode, lower_offset, len);
+		sb_end_write(lower_inode->i_sb);
+		if (rc)
+			break;
+		if (drop_cache) {
+			truncate_inode_pages_range(&inode->i_data, lower_offset, lower_offset + len - 1);
+			truncate_inode_pages_range(&inode_info->i_decrypt, offset, offset + len - 1);
+		}
+		fsstack_copy_attr_times(inode, lower_inode);
+		if (old_size != i_size_read(lower_inode)) {
+			fsstack_copy_inode_size(inode, lower_inode);
+			teadfs_notify_event(TET_TRUNCATE, inode, &lower_file->f_path, NULL);
+		}
+	} while (0);
+	mutex_unlock(&inode->i_mutex);
+	LOG_DBG("LEVAL rc : [%ld]\n", rc);
+	return rc;
+}
+
 static int
 teadfs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 {
@@ -575,11 +975,12 @@ const struct file_operations teadfs_main_fops = {
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = teadfs_compat_ioctl,
 #endif
-	.mmap = generic_file_mmap,
+	.mmap = teadfs_mmap,
 	.open = teadfs_open,
 	.flush = teadfs_flush,
 	.release = teadfs_release,
 	.fsync = teadfs_fsync,
 	.fasync = teadfs_fasync,
+	.fallocate = teadfs_fallocate,
 	.splice_read = generic_file_splice_read,
 };
@@ -12,4 +12,6 @@ struct file* teadfs_get_lower_file(struct dentry* dentry, struct inode* inode, i
 
 void teadfs_put_lower_file(struct inode* inode, struct file* file);
 
+int teadfs_read_file_header(struct inode* inode, struct file* lower_file);
+
 #endif // !FILE_H
@@ -1,17 +1,24 @@
 #include "global_param.h"
 #include "teadfs_log.h"
+#include "teadfs_header.h"
+#include "mem.h"
+
+#include <linux/rculist.h>
+#include <linux/path.h>
+
+//grants a session keeps for a daemon which does not take them, the oldest go first
+#define TEADFS_FD_GRANTS_MAX 256
 
 struct global_param {
+	//serializes changes of session_list and of session clients
 	struct mutex mux;
-	__u64 unique_id;
-	pid_t pid;
-	int connect;
+	atomic64_t unique_id;
+	//struct teadfs_session, readers walk it under rcu
+	struct list_head session_list;
+	struct teadfs_session* default_session;
 } global_param;
 
 
-static struct comm_msg_queue g_comm_msg_queue;
-
-
 //init
 int teadfs_init_global_param(void) {
 	int rc = 0;
@@ -20,11 +27,14 @@ int teadfs_init_global_param(void) {
 
 	mutex_init(&(global_param.mux));
 	// 0 cann't use
-	global_param.unique_id = 1;
-
+	atomic64_set(&(global_param.unique_id), 1);
+	INIT_LIST_HEAD(&(global_param.session_list));
 
-	mutex_init(&(g_comm_msg_queue.mux));
-	INIT_LIST_HEAD(&(g_comm_msg_queue.msg_ctx_queue));
+	//mounts without session= and daemons not asking for one meet here
+	global_param.default_session = teadfs_get_session(0);
+	if (!global_param.default_session) {
+		rc = -ENOMEM;
+	}
 
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
@@ -32,52 +42,345 @@ int teadfs_init_global_param(void) {
 
 //release
 void teadfs_release_global_param(void) {
-
+	if (global_param.default_session) {
+		teadfs_put_session(global_param.default_session);
+		global_param.default_session = NULL;
+	}
+	//sessions and clients freed by kfree_rcu
+	rcu_barrier();
 }
 
 __u64 teadfs_get_next_msg_id(void) {
-	__u64 msg_id;
-	mutex_lock(&(global_param.mux));
-	global_param.unique_id++;
+	__u64 msg_id = atomic64_inc_return(&(global_param.unique_id));
 
-	if (0 == global_param.unique_id) {
-		global_param.unique_id = 1;
+	//wrapped around, 0 cann't use
+	if (unlikely(0 == msg_id)) {
+		msg_id = atomic64_inc_return(&(global_param.unique_id));
 	}
-	msg_id = global_param.unique_id;
-	mutex_unlock(&(global_param.mux));
 	return msg_id;
 }
 
-struct comm_msg_queue* teadfs_get_msg_queue(void) {
-	return &g_comm_msg_queue;
+//session with a reference taken, NULL if none or it is being freed. rcu read lock or mux held
+static struct teadfs_session* teadfs_lookup_session(__u32 id) {
+	struct teadfs_session* session;
+
+	list_for_each_entry_rcu(session, &(global_param.session_list), list) {
+		if (session->id == id && atomic_inc_not_zero(&session->count)) {
+			return session;
+		}
+	}
+	return NULL;
 }
 
-//user process
-pid_t teadfs_get_client_pid(void) {
-	pid_t pid;
+struct teadfs_session* teadfs_get_session(__u32 id) {
+	struct teadfs_session* session, *new_session;
+
+	rcu_read_lock();
+	session = teadfs_lookup_session(id);
+	rcu_read_unlock();
+	if (session) {
+		return session;
+	}
+	new_session = teadfs_zalloc(sizeof(struct teadfs_session), GFP_KERNEL);
 	mutex_lock(&(global_param.mux));
-	pid = global_param.pid ;
+	do {
+		session = teadfs_lookup_session(id);
+		if (session) {
+			break;
+		}
+		session = new_session;
+		if (!session) {
+			break;
+		}
+		new_session = NULL;
+		session->id = id;
+		atomic_set(&session->count, 1);
+		RCU_INIT_POINTER(session->client, NULL);
+		mutex_init(&(session->msg_queue.mux));
+		INIT_LIST_HEAD(&(session->msg_queue.msg_ctx_queue));
+		spin_lock_init(&session->grant_lock);
+		INIT_LIST_HEAD(&session->grants);
+		//directories start at 0, never announced
+		atomic_set(&session->name_epoch, 1);
+		list_add_tail_rcu(&session->list, &(global_param.session_list));
+	} while (0);
 	mutex_unlock(&(global_param.mux));
-	return  pid;
+	if (new_session) {
+		teadfs_free(new_session);
+	}
+	return session;
 }
 
-void teadfs_set_client_pid(pid_t pid) {
-	mutex_lock(&(global_param.mux));
-	global_param.pid = pid;
-	mutex_unlock(&(global_param.mux));
+static void teadfs_free_fd_grants(struct list_head* grants) {
+	struct teadfs_fd_grant* grant, *tmp;
+
+	list_for_each_entry_safe(grant, tmp, grants, list) {
+		list_del(&grant->list);
+		path_put(&grant->path);
+		teadfs_free(grant);
+	}
 }
 
+//daemon gone or session freed, nobody takes them
+static void teadfs_drop_fd_grants(struct teadfs_session* session) {
+	LIST_HEAD(grants);
 
+	spin_lock(&session->grant_lock);
+	list_splice_init(&session->grants, &grants);
+	session->grant_count = 0;
+	spin_unlock(&session->grant_lock);
+	teadfs_free_fd_grants(&grants);
+}
 
-int  teadfs_get_client_connect(void) {
-	int connect;
-	mutex_lock(&(global_param.mux));
-	connect = global_param.connect;
+void teadfs_drop_sb_fd_grants(struct teadfs_session* session, struct super_block* sb) {
+	struct teadfs_fd_grant* grant, *tmp;
+	LIST_HEAD(grants);
+
+	spin_lock(&session->grant_lock);
+	list_for_each_entry_safe(grant, tmp, &session->grants, list) {
+		if (grant->sb == sb) {
+			list_move_tail(&grant->list, &grants);
+			session->grant_count--;
+		}
+	}
+	spin_unlock(&session->grant_lock);
+	teadfs_free_fd_grants(&grants);
+}
+
+void teadfs_put_session(struct teadfs_session* session) {
+	if (!atomic_dec_and_mutex_lock(&session->count, &(global_param.mux))) {
+		return;
+	}
+	list_del_rcu(&session->list);
 	mutex_unlock(&(global_param.mux));
-	return  connect;
+	teadfs_drop_fd_grants(session);
+	kfree_rcu(session, rcu);
+}
+
+struct teadfs_session* teadfs_default_session(void) {
+	return global_param.default_session;
+}
+
+struct teadfs_session* teadfs_find_session_pid(pid_t pid) {
+	struct teadfs_session* session, *found = NULL;
+	struct teadfs_client* client;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(session, &(global_param.session_list), list) {
+		client = rcu_dereference(session->client);
+		if (client && client->pid == pid && atomic_inc_not_zero(&session->count)) {
+			found = session;
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return found;
 }
-void teadfs_set_clinet_connect(int connect) {
+
+int teadfs_bind_session(__u32 id, pid_t pid, __u32 features) {
+	struct teadfs_session* session;
+	struct teadfs_client* client;
+	struct teadfs_client* old_client;
+	int rc = 0;
+
+	session = teadfs_get_session(id);
+	if (!session) {
+		return -ENOMEM;
+	}
+	client = teadfs_zalloc(sizeof(struct teadfs_client), GFP_KERNEL);
 	mutex_lock(&(global_param.mux));
-	global_param.connect = connect;
+	do {
+		old_client = rcu_dereference_protected(session->client, lockdep_is_held(&(global_param.mux)));
+		if (old_client) {
+			//hello again from the bound daemon
+			if (old_client->pid != pid) {
+				rc = -EBUSY;
+			}
+			break;
+		}
+		if (!client) {
+			rc = -ENOMEM;
+			break;
+		}
+		client->pid = pid;
+		client->features = features;
+		rcu_assign_pointer(session->client, client);
+		//new daemon knows no directory
+		teadfs_invalidate_names(session);
+		client = NULL;
+		//keep the reference of teadfs_get_session while bound
+		session = NULL;
+	} while (0);
 	mutex_unlock(&(global_param.mux));
-}
\ No newline at end of file
+	if (client) {
+		teadfs_free(client);
+	}
+	if (session) {
+		teadfs_put_session(session);
+	}
+	LOG_INF("session:%u, pid:%d, features:0x%x, rc:%d\n", id, pid, features, rc);
+	return rc;
+}
+
+void teadfs_unbind_session_pid(pid_t pid) {
+	struct teadfs_session* session;
+	struct teadfs_client* client;
+	struct teadfs_msg_ctx* msg_ctx;
+	int bound;
+
+	while ((session = teadfs_find_session_pid(pid))) {
+		mutex_lock(&(global_param.mux));
+		client = rcu_dereference_protected(session->client, lockdep_is_held(&(global_param.mux)));
+		bound = client && client->pid == pid;
+		if (bound) {
+			RCU_INIT_POINTER(session->client, NULL);
+			kfree_rcu(client, rcu);
+		}
+		mutex_unlock(&(global_param.mux));
+		if (!bound) {
+			//unbound by another caller meanwhile
+			teadfs_put_session(session);
+			continue;
+		}
+		LOG_INF("session:%u, pid:%d gone\n", session->id, pid);
+
+		//nobody will answer, wake the waiters now instead of at the timeout
+		mutex_lock(&(session->msg_queue.mux));
+		list_for_each_entry(msg_ctx, &(session->msg_queue.msg_ctx_queue), out_list) {
+			mutex_lock(&msg_ctx->mux);
+			if (TEADFS_MSG_CTX_STATE_PENDING == msg_ctx->state) {
+				msg_ctx->state = TEADFS_MSG_CTX_STATE_DONE;
+				wake_up(&(msg_ctx->wait));
+			}
+			mutex_unlock(&msg_ctx->mux);
+		}
+		mutex_unlock(&(session->msg_queue.mux));
+		teadfs_drop_fd_grants(session);
+
+		//reference of teadfs_find_session_pid and the one held while bound
+		teadfs_put_session(session);
+		teadfs_put_session(session);
+	}
+}
+
+struct comm_msg_queue* teadfs_get_msg_queue(struct teadfs_session* session) {
+	return &(session->msg_queue);
+}
+
+//user process, 0 while no daemon is bound
+pid_t teadfs_get_client_pid(struct teadfs_session* session) {
+	struct teadfs_client* client;
+	pid_t pid = 0;
+
+	rcu_read_lock();
+	client = rcu_dereference(session->client);
+	if (client) {
+		pid = client->pid;
+	}
+	rcu_read_unlock();
+	return  pid;
+}
+
+int  teadfs_get_client_connect(struct teadfs_session* session) {
+	return rcu_access_pointer(session->client) != NULL;
+}
+
+__u32 teadfs_get_client_features(struct teadfs_session* session) {
+	struct teadfs_client* client;
+	__u32 features = 0;
+
+	rcu_read_lock();
+	client = rcu_dereference(session->client);
+	if (client) {
+		features = client->features;
+	}
+	rcu_read_unlock();
+	return features;
+}
+
+unsigned int teadfs_get_name_epoch(struct teadfs_session* session) {
+	return (unsigned int)atomic_read(&session->name_epoch);
+}
+
+void teadfs_invalidate_names(struct teadfs_session* session) {
+	//0 is left to directories never announced
+	if (unlikely(!atomic_inc_return(&session->name_epoch))) {
+		atomic_inc(&session->name_epoch);
+	}
+}
+
+__u64 teadfs_grant_fd(struct teadfs_session* session, struct super_block* sb, struct path* path,
+	int flags, __u32 feature) {
+	struct teadfs_fd_grant* grant;
+	LIST_HEAD(dropped);
+	__u64 token;
+
+	if (!(teadfs_get_client_features(session) & feature)) {
+		return 0;
+	}
+	grant = teadfs_zalloc(sizeof(struct teadfs_fd_grant), GFP_KERNEL);
+	if (!grant) {
+		return 0;
+	}
+	token = teadfs_get_next_msg_id();
+	grant->token = token;
+	grant->path = *path;
+	path_get(&grant->path);
+	grant->flags = flags;
+	grant->sb = sb;
+
+	spin_lock(&session->grant_lock);
+	list_add_tail(&grant->list, &session->grants);
+	if (++session->grant_count > TEADFS_FD_GRANTS_MAX) {
+		list_move(session->grants.next, &dropped);
+		session->grant_count--;
+	}
+	spin_unlock(&session->grant_lock);
+	teadfs_free_fd_grants(&dropped);
+	return token;
+}
+
+//unlink the grant of token, grant_lock held. NULL if none
+static struct teadfs_fd_grant* teadfs_unlink_fd_grant(struct teadfs_session* session, __u64 token) {
+	struct teadfs_fd_grant* grant;
+
+	list_for_each_entry(grant, &session->grants, list) {
+		if (grant->token == token) {
+			list_del(&grant->list);
+			session->grant_count--;
+			return grant;
+		}
+	}
+	return NULL;
+}
+
+void teadfs_revoke_fd(struct teadfs_session* session, __u64 token) {
+	struct teadfs_fd_grant* grant;
+
+	if (!token) {
+		return;
+	}
+	spin_lock(&session->grant_lock);
+	grant = teadfs_unlink_fd_grant(session, token);
+	spin_unlock(&session->grant_lock);
+	if (grant) {
+		path_put(&grant->path);
+		teadfs_free(grant);
+	}
+}
+
+int teadfs_claim_fd(struct teadfs_session* session, __u64 token, struct path* path, int* flags) {
+	struct teadfs_fd_grant* grant;
+
+	spin_lock(&session->grant_lock);
+	grant = teadfs_unlink_fd_grant(session, token);
+	spin_unlock(&session->grant_lock);
+	if (!grant) {
+		return -ENOENT;
+	}
+	//reference moves to the caller
+	*path = grant->path;
+	*flags = grant->flags;
+	teadfs_free(grant);
+	return 0;
+}
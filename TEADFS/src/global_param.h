@@ -3,12 +3,54 @@
 
 
 #include <linux/fs.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
 
 struct comm_msg_queue {
 	struct mutex mux;
 	struct list_head msg_ctx_queue;
 };
 
+/* daemon bound to a session, replaced whole on reconnect and freed after a grace period */
+struct teadfs_client {
+	//daemon process, also its netlink port
+	pid_t pid;
+	//PR_HELLO_* asked by the daemon
+	__u32 features;
+	struct rcu_head rcu;
+};
+
+/* lower file kept for the daemon to open by TEADFS_IOC_TAKE_FD */
+struct teadfs_fd_grant {
+	struct list_head list;
+	__u64 token;
+	struct path path;
+	//open flags of the fd
+	int flags;
+	//teadfs mount of the file, its grants go with it
+	struct super_block* sb;
+};
+
+/* user mode daemon serving the mounts with the same session= option */
+struct teadfs_session {
+	//in session_list, walked under rcu
+	struct list_head list;
+	__u32 id;
+	//mounts using it, plus one while a daemon is bound. freed after a grace period at zero
+	atomic_t count;
+	//daemon bound by PR_MSG_HELLO, NULL while not connected
+	struct teadfs_client __rcu* client;
+	//upcalls waiting for this daemon only
+	struct comm_msg_queue msg_queue;
+	//struct teadfs_fd_grant not taken yet, oldest first
+	spinlock_t grant_lock;
+	struct list_head grants;
+	int grant_count;
+	//directory paths announced before a change of it are stale, PR_HELLO_IDENTITY
+	atomic_t name_epoch;
+	struct rcu_head rcu;
+};
+
 //init
 int teadfs_init_global_param(void);
 
@@ -18,15 +60,43 @@ void teadfs_release_global_param(void);
 // get msg id. id will auto increment
 __u64 teadfs_get_next_msg_id(void);
 
+//find or create session. put it with teadfs_put_session
+struct teadfs_session* teadfs_get_session(__u32 id);
+void teadfs_put_session(struct teadfs_session* session);
+//session 0, used when there is no mount to pick one
+struct teadfs_session* teadfs_default_session(void);
+//session the daemon of pid is bound to, NULL if none. put it after use
+struct teadfs_session* teadfs_find_session_pid(pid_t pid);
+
+//bind daemon to session, -EBUSY if another daemon has it
+int teadfs_bind_session(__u32 id, pid_t pid, __u32 features);
+//daemon of pid is gone, upcalls waiting for it are failed
+void teadfs_unbind_session_pid(pid_t pid);
+
 //get list of send to user msg
-struct comm_msg_queue* teadfs_get_msg_queue(void);
+struct comm_msg_queue* teadfs_get_msg_queue(struct teadfs_session* session);
 
 //user process
-pid_t teadfs_get_client_pid(void);
-void teadfs_set_client_pid(pid_t pid);
+pid_t teadfs_get_client_pid(struct teadfs_session* session);
 
-int  teadfs_get_client_connect(void);
-void teadfs_set_clinet_connect(int connect);
-#endif
+int  teadfs_get_client_connect(struct teadfs_session* session);
 
+//PR_HELLO_* asked by the bound daemon, 0 while not connected
+__u32 teadfs_get_client_features(struct teadfs_session* session);
 
+//directory paths the daemon got at another epoch are sent again
+unsigned int teadfs_get_name_epoch(struct teadfs_session* session);
+//a directory was renamed, or the daemon changed
+void teadfs_invalidate_names(struct teadfs_session* session);
+
+//keep the lower path of a file of sb for the daemon to open with flags. token, 0 if the
+//daemon did not ask for fds with feature, PR_HELLO_OPEN_FD or PR_HELLO_RELEASE_FD
+__u64 teadfs_grant_fd(struct teadfs_session* session, struct super_block* sb, struct path* path,
+	int flags, __u32 feature);
+//the mount goes away, drop the grants of its files
+void teadfs_drop_sb_fd_grants(struct teadfs_session* session, struct super_block* sb);
+//upcall answered, drop the grant if the daemon did not take it. 0 is ignored
+void teadfs_revoke_fd(struct teadfs_session* session, __u64 token);
+//take the grant of token, the caller puts path. -ENOENT if taken, revoked or dropped
+int teadfs_claim_fd(struct teadfs_session* session, __u64 token, struct path* path, int* flags);
+#endif
@@ -7,6 +7,7 @@
 #include "user_com.h"
 #include "mem.h"
 #include "mmap.h"
+#include "inode.h"
 
 #include <linux/fs.h>
 #include <linux/fs_stack.h>
@@ -15,6 +16,7 @@
 #include <linux/module.h>
 #include <linux/uaccess.h>
 #include <linux/namei.h>
+#include <linux/sched.h>
 
 static struct dentry* lock_parent(struct dentry* dentry)
 {
@@ -94,6 +96,26 @@ static int teadfs_create(struct inode* dir, struct dentry* dentry,
 
 
 
+int teadfs_prefetched_size(struct inode* inode, loff_t lower_size, loff_t* size)
+{
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	int rc = 0;
+
+	spin_lock(&inode->i_lock);
+	if (inode_info->attr_access && time_before(jiffies, inode_info->attr_expires)
+		&& inode_info->attr_lower_size == lower_size && inode_info->attr_pid == task_tgid(current)) {
+		rc = 1;
+		if (inode_info->attr_plain_size >= 0)
+			*size = inode_info->attr_plain_size;
+		else if (OFR_DECRYPT == inode_info->attr_access)
+			*size = lower_size - ENCRYPT_FILE_HEADER_SIZE;
+		else
+			*size = lower_size;
+	}
+	spin_unlock(&inode->i_lock);
+	return rc;
+}
+
 static int teadfs_getattr(struct vfsmount* mnt, struct dentry* dentry,
 	struct kstat* stat)
 {
@@ -114,9 +136,11 @@ static int teadfs_getattr(struct vfsmount* mnt, struct dentry* dentry,
 		generic_fillattr(dentry->d_inode, stat);
 		stat->blocks = lower_stat.blocks;
 
-		
-		if (S_ISREG(stat->mode) && inode_info->file_decrypt) {
-			access = teadfs_request_open_path(&lower_path);
+		//a listing just asked user mode about this file
+		if (S_ISREG(stat->mode) && teadfs_prefetched_size(dentry->d_inode, lower_stat.size, &stat->size)) {
+			teadfs_stats_inc(dentry->d_sb, TS_PREFETCH_HIT);
+		} else if (S_ISREG(stat->mode) && inode_info->file_decrypt) {
+			access = teadfs_request_open_path(dentry->d_inode, dentry, &lower_path);
 			if (OFR_DECRYPT == access) {
 				(*stat).size -= ENCRYPT_FILE_HEADER_SIZE;
 			}
@@ -179,6 +203,9 @@ static int teadfs_setattr(struct dentry* dentry, struct iattr* ia)
 		mutex_lock(&lower_dentry->d_inode->i_mutex);
 		rc = notify_change(lower_dentry, &lower_ia, NULL);
 		mutex_unlock(&lower_dentry->d_inode->i_mutex);
+		if (!rc && (ia->ia_valid & ATTR_SIZE) && S_ISREG(inode->i_mode)) {
+			teadfs_notify_event(TET_TRUNCATE, inode, &lower_path, NULL);
+		}
 	} while (0);
 	fsstack_copy_attr_all(inode, lower_inode);
 	teadfs_put_lower_path(dentry, &lower_path);
@@ -345,6 +372,7 @@ static int teadfs_unlink(struct inode* dir, struct dentry* dentry)
 	int rc;
 	struct inode* inode = dentry->d_inode;
 	struct path lower_path;
+	struct teadfs_notify_item* event = NULL;
 
 	LOG_INF("ENTRY :%s\n", dentry->d_name.name);
 	do {
@@ -353,6 +381,7 @@ static int teadfs_unlink(struct inode* dir, struct dentry* dentry)
 		lower_dentry = lower_path.dentry;
 		dget(lower_dentry);
 		lower_dir_dentry = lock_parent(lower_dentry);
+		event = teadfs_event_prepare(TET_UNLINK, inode, &lower_path, NULL);
 		rc = vfs_unlink(lower_dir_inode, lower_dentry
 #if defined(CONFIG_VFS_UNLINK_4_PARAM)
 			,NULL
@@ -360,8 +389,10 @@ static int teadfs_unlink(struct inode* dir, struct dentry* dentry)
 			);
 		if (rc) {
 			printk(KERN_ERR "Error in vfs_unlink; rc = [%d]\n", rc);
+			teadfs_event_cancel(event);
 			break;
 		}
+		teadfs_event_commit(event);
 		fsstack_copy_attr_times(dir, lower_dir_inode);
 		set_nlink(inode, teadfs_inode_to_lower(inode)->i_nlink);
 		inode->i_ctime = dir->i_ctime;
@@ -627,10 +658,11 @@ teadfs_rename(struct inode* old_dir, struct dentry* old_dentry,
 	struct inode* target_inode;
 	int is_rename_lock = 0;
 	struct path lower_old_path, lower_new_path;
+	struct teadfs_notify_item* event = NULL;
 
 	LOG_DBG("ENTRY\n");
 	do {
-		LOG_INF("rename: %s --> %s\n", old_dentry->d_name.name, new_dentry->d_name.name)
+		LOG_INF("rename: %s --> %s\n", old_dentry->d_name.name, new_dentry->d_name.name);
 		teadfs_get_lower_path(old_dentry, &lower_old_path);
 		lower_old_dentry = lower_old_path.dentry;
 		teadfs_get_lower_path(new_dentry, &lower_new_path);
@@ -652,6 +684,8 @@ teadfs_rename(struct inode* old_dir, struct dentry* old_dentry,
 			break;
 		}
 		is_rename_lock = 1;
+		//old path is gone after rename
+		event = teadfs_event_prepare(TET_RENAME, d_inode(old_dentry), &lower_old_path, &lower_new_path);
 		rc = vfs_rename(lower_old_dir_dentry->d_inode, lower_old_dentry,
 			lower_new_dir_dentry->d_inode, lower_new_dentry
 #if defined(CONFIG_VFS_RENAME_6_PARAM)
@@ -659,8 +693,14 @@ teadfs_rename(struct inode* old_dir, struct dentry* old_dentry,
 			, 0
 #endif
 		);
-		if (rc)
+		if (rc) {
+			teadfs_event_cancel(event);
 			break;
+		}
+		teadfs_event_commit(event);
+		//paths under it the daemon has are stale
+		if (S_ISDIR(old_dentry->d_inode->i_mode))
+			teadfs_invalidate_names(teadfs_sb_session(old_dir->i_sb));
 		if (target_inode)
 			fsstack_copy_attr_all(target_inode,
 				teadfs_inode_to_lower(target_inode));
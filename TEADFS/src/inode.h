@@ -9,4 +9,9 @@ extern const struct inode_operations teadfs_dir_iops;
 
 extern const struct inode_operations teadfs_main_iops;
 
+#include <linux/fs.h>
+
+//size reported from a readdirplus answer, zero if there is none for lower_size
+int teadfs_prefetched_size(struct inode* inode, loff_t lower_size, loff_t* size);
+
 #endif // !INODE_H
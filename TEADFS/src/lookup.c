@@ -6,6 +6,7 @@
 #include "mmap.h"
 #include "inode.h"
 #include "file.h"
+#include "config.h"
 
 #include <linux/fs.h>
 #include <linux/mm.h>
@@ -113,7 +114,7 @@ static int teadfs_lookup_interpose(struct dentry* dentry,
 			break;
 		}
 		teadfs_set_dentry_private(dentry, dentry_info);
-		spin_lock_init(&(dentry_info->lock));
+		teadfs_init_dentry_private(dentry_info);
 
 		parent = dget_parent(dentry);
 		teadfs_get_lower_path(parent, &lower_parent_path);
@@ -156,6 +157,46 @@ static int teadfs_lookup_interpose(struct dentry* dentry,
 
 
 
+/**
+ * teadfs_lookup_lower
+ * @name: Name to look up
+ * @len: Length of @name
+ * @lower_dir_dentry: Lower directory
+ *
+ * Same as lookup_one_len, but a name already in the lower dcache is
+ * found without the lower directory i_mutex. Only a miss, or a lower
+ * filesystem with its own name hashing or revalidation, takes the lock,
+ * so lookups in one directory do not serialize on it.
+ */
+static struct dentry* teadfs_lookup_lower(const char* name, int len,
+	struct dentry* lower_dir_dentry)
+{
+	struct dentry* lower_dentry = NULL;
+	struct qstr this;
+	int rc;
+
+	if (!(lower_dir_dentry->d_flags & DCACHE_OP_HASH)) {
+		//lookup_one_len checks it under the lock
+		rc = inode_permission(lower_dir_dentry->d_inode, MAY_EXEC);
+		if (rc)
+			return ERR_PTR(rc);
+		this.name = name;
+		this.len = len;
+		this.hash = full_name_hash(name, len);
+		lower_dentry = d_lookup(lower_dir_dentry, &this);
+		if (lower_dentry && (lower_dentry->d_flags & DCACHE_OP_REVALIDATE)) {
+			dput(lower_dentry);
+			lower_dentry = NULL;
+		}
+	}
+	if (!lower_dentry) {
+		mutex_lock(&lower_dir_dentry->d_inode->i_mutex);
+		lower_dentry = lookup_one_len(name, lower_dir_dentry, len);
+		mutex_unlock(&lower_dir_dentry->d_inode->i_mutex);
+	}
+	return lower_dentry;
+}
+
 /**
  * teadfs_lookup
  * @ecryptfs_dir_inode: The eCryptfs directory inode
@@ -177,11 +218,8 @@ struct dentry* teadfs_lookup(struct inode* ecryptfs_dir_inode,
 		parent = dget_parent(dentry);
 		teadfs_get_lower_path(parent, &lower_parent_path);
 		lower_dir_dentry = lower_parent_path.dentry;
-		mutex_lock(&lower_dir_dentry->d_inode->i_mutex);
-		lower_dentry = lookup_one_len(dentry->d_name.name,
-			lower_dir_dentry,
-			dentry->d_name.len);
-		mutex_unlock(&lower_dir_dentry->d_inode->i_mutex);
+		lower_dentry = teadfs_lookup_lower(dentry->d_name.name,
+			dentry->d_name.len, lower_dir_dentry);
 		if (IS_ERR(lower_dentry)) {
 			rc = PTR_ERR(lower_dentry);
 			LOG_ERR("%s: lookup_one_len() returned "
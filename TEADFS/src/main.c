@@ -7,6 +7,8 @@
 #include "netlink.h"
 #include "global_param.h"
 #include "miscdev.h"
+#include "user_com.h"
+#include "cache.h"
 
 #include <linux/init.h>
 #include <linux/module.h>
@@ -14,9 +16,152 @@
 #include <linux/fs.h>
 #include <linux/namei.h>
 #include <linux/string.h>
+#include <linux/parser.h>
+#include <linux/slab.h>
 
 
 
+enum {
+	teadfs_opt_ra_pages,
+	teadfs_opt_max_inflight,
+	teadfs_opt_upcall_timeout,
+	teadfs_opt_verdict_ttl,
+	teadfs_opt_verdict_cache,
+	teadfs_opt_passthrough,
+	teadfs_opt_format,
+	teadfs_opt_transport,
+	teadfs_opt_session,
+	teadfs_opt_decrypt_budget,
+	teadfs_opt_readdirplus,
+	teadfs_opt_lower_nocache,
+	teadfs_opt_err,
+};
+
+static const match_table_t tokens = {
+	{teadfs_opt_ra_pages, "ra_pages=%u"},
+	{teadfs_opt_max_inflight, "max_inflight=%u"},
+	{teadfs_opt_upcall_timeout, "upcall_timeout=%u"},
+	{teadfs_opt_verdict_ttl, "verdict_ttl=%u"},
+	{teadfs_opt_verdict_cache, "verdict_cache=%u"},
+	{teadfs_opt_passthrough, "passthrough"},
+	{teadfs_opt_format, "format=%u"},
+	{teadfs_opt_transport, "transport=%s"},
+	{teadfs_opt_session, "session=%u"},
+	{teadfs_opt_decrypt_budget, "decrypt_budget=%u"},
+	{teadfs_opt_readdirplus, "readdirplus=%u"},
+	{teadfs_opt_lower_nocache, "lower_nocache"},
+	{teadfs_opt_err, NULL}
+};
+
+/**
+ * teadfs_parse_options
+ * @opts: Filled with the defaults, then the given options
+ * @options: The options passed to the kernel, may be NULL
+ *
+ * Returns zero on success; non-zero on an unknown or bad option
+ */
+static int teadfs_parse_options(struct teadfs_mount_opts* opts, char* options)
+{
+	char* p;
+	substring_t args[MAX_OPT_ARGS];
+	int token;
+	int value;
+	char* transport;
+	int rc = 0;
+
+	opts->ra_pages = VM_MAX_READAHEAD * 1024 / PAGE_CACHE_SIZE;
+	opts->max_inflight = 0;
+	opts->upcall_timeout = 30;
+	opts->verdict_ttl = 0;
+	opts->verdict_cache = 8;
+	opts->passthrough = 0;
+	opts->format = TEADFS_FORMAT_V1;
+	opts->transport = TTP_NETLINK;
+	opts->session = 0;
+	opts->decrypt_budget = 0;
+	opts->readdirplus = 0;
+	opts->lower_nocache = 0;
+	if (!options)
+		return 0;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+		token = match_token(p, tokens, args);
+		switch (token) {
+		case teadfs_opt_passthrough:
+			opts->passthrough = 1;
+			continue;
+		case teadfs_opt_lower_nocache:
+			opts->lower_nocache = 1;
+			continue;
+		case teadfs_opt_transport:
+			transport = match_strdup(&args[0]);
+			if (!transport) {
+				rc = -ENOMEM;
+				break;
+			}
+			//netlink is the only transport carrying upcalls
+			if (strcmp(transport, "netlink"))
+				rc = -EINVAL;
+			kfree(transport);
+			break;
+		case teadfs_opt_err:
+			rc = -EINVAL;
+			break;
+		default:
+			if (match_int(&args[0], &value) || value < 0) {
+				rc = -EINVAL;
+				break;
+			}
+			switch (token) {
+			case teadfs_opt_ra_pages:
+				opts->ra_pages = value;
+				break;
+			case teadfs_opt_max_inflight:
+				opts->max_inflight = value;
+				break;
+			case teadfs_opt_upcall_timeout:
+				if (!value)
+					rc = -EINVAL;
+				opts->upcall_timeout = value;
+				break;
+			case teadfs_opt_verdict_ttl:
+				opts->verdict_ttl = value;
+				break;
+			case teadfs_opt_verdict_cache:
+				opts->verdict_cache = value;
+				break;
+			case teadfs_opt_format:
+				if (value < TEADFS_FORMAT_V1 || value > TEADFS_FORMAT_V3)
+					rc = -EINVAL;
+				opts->format = value;
+				break;
+			case teadfs_opt_session:
+				opts->session = value;
+				break;
+			case teadfs_opt_decrypt_budget:
+				opts->decrypt_budget = value;
+				break;
+			case teadfs_opt_readdirplus:
+#if defined(CONFIG_ITERATE_DIR)
+				//.iterate hands the caller's context to the lower readdir, the names are never seen
+				if (value)
+					rc = -EINVAL;
+#endif
+				opts->readdirplus = value;
+				break;
+			}
+			break;
+		}
+		if (rc) {
+			LOG_ERR("bad mount option: %s\n", p);
+			break;
+		}
+	}
+	return rc;
+}
+
 /**
  * teadfs_mount
  * @fs_type
@@ -43,6 +188,20 @@ static struct dentry* teadfs_mount(struct file_system_type* fs_type, int flags,
 			rc = -ENOMEM;
 			break;
 		}
+		spin_lock_init(&sbi->inode_list_lock);
+		INIT_LIST_HEAD(&sbi->inode_list);
+		err = "Parsing options failed";
+		rc = teadfs_parse_options(&sbi->opts, raw_data);
+		if (rc)
+			break;
+		teadfs_upcall_window_init(&sbi->upcall_window);
+		//upcalls of this mount go to the daemon bound to the session
+		sbi->session = teadfs_get_session(sbi->opts.session);
+		if (!sbi->session) {
+			rc = -ENOMEM;
+			break;
+		}
+		err = "Getting sb failed";
 		s = sget(fs_type, NULL, set_anon_super, flags, NULL);
 		if (IS_ERR(s)) {
 			rc = PTR_ERR(s);
@@ -56,11 +215,22 @@ static struct dentry* teadfs_mount(struct file_system_type* fs_type, int flags,
 			LOG_ERR("bdi_setup_and_register() failed\n");
 			break;
 		}
+		sbi->bdi.ra_pages = sbi->opts.ra_pages;
 		s->s_bdi = &sbi->bdi;
 #endif
 		teadfs_set_lower_super(s, sbi);
 		/* ->kill_sb() will take care of sbi after that point */
 		sbi = NULL;
+		rc = teadfs_stats_create(s);
+		if (rc) {
+			LOG_ERR("teadfs_stats_create() failed\n");
+			break;
+		}
+		rc = teadfs_decrypt_cache_create(s);
+		if (rc) {
+			LOG_ERR("teadfs_decrypt_cache_create() failed\n");
+			break;
+		}
 		s->s_op = &teadfs_sops;
 		s->s_d_op = &teadfs_dops;
 
@@ -116,7 +286,7 @@ static struct dentry* teadfs_mount(struct file_system_type* fs_type, int flags,
 		root_info = teadfs_zalloc(sizeof(struct teadfs_dentry_info), GFP_KERNEL);
 		if (!root_info)
 			break;
-		spin_lock_init(&(root_info->lock));
+		teadfs_init_dentry_private(root_info);
 		/* ->kill_sb() will take care of root_info */
 		teadfs_set_dentry_private(s->s_root, root_info);
 		teadfs_set_lower_path(s->s_root, &lower_path);
@@ -133,6 +303,9 @@ static struct dentry* teadfs_mount(struct file_system_type* fs_type, int flags,
 		deactivate_locked_super(s);
 	}
 	if (sbi) {
+		if (sbi->session) {
+			teadfs_put_session(sbi->session);
+		}
 		teadfs_free(sbi);
 	}
 	LOG_ERR("%s; rc = [%d]\n", err, rc);
@@ -152,9 +325,21 @@ static void teadfs_kill_block_super(struct super_block* sb)
 	
 	LOG_DBG("ENTRY\n");
 	do {
+		//no trimming while the inodes are evicted
+		teadfs_decrypt_cache_destroy(sb);
+		//queued notifies still count into the stats of this mount and hold its dentries
+		teadfs_flush_user_com();
+		//grants not taken yet pin lower paths, the lower mount would stay busy
+		if (sb_info && sb_info->session) {
+			teadfs_drop_sb_fd_grants(sb_info->session, sb);
+		}
 		kill_anon_super(sb);
 		if (!sb_info)
 			break;
+		teadfs_stats_destroy(sb);
+		if (sb_info->session) {
+			teadfs_put_session(sb_info->session);
+		}
 #if defined(CONFIG_BDICONFIG_BDI)
 		bdi_destroy(&sb_info->bdi);
 #endif
@@ -176,38 +361,78 @@ MODULE_ALIAS_FS("teadfs");
 
 static int __init teadfs_module_init(void) {
     int rc;
+	//parts set up so far, undone in reverse when a later one fails
+	int stage = 0;
 
 	teadfs_log_create();
 
     LOG_DBG("ENTRY\n");
     do {
-        rc = register_filesystem(&teadfs_fs_type);
-        if (rc) {
-            LOG_ERR("Failed to register filesystem\n");
-            break;
-        }
 		//init param
-		teadfs_init_global_param();
+		rc = teadfs_init_global_param();
+		if (rc) {
+			LOG_ERR("Failed to init global param\n");
+			break;
+		}
+		stage = 1;
 
 		//create netlink
-		teadfs_start_netlink();
+		rc = teadfs_start_netlink();
+		if (rc) {
+			LOG_ERR("Failed to start netlink\n");
+			break;
+		}
+		stage = 2;
+
+		//release notify queue
+		rc = teadfs_init_user_com();
+		if (rc) {
+			LOG_ERR("Failed to init notify queue\n");
+			break;
+		}
+		stage = 3;
 
 		// check client is connect ?
-		teadfs_init_miscdev();
+		rc = teadfs_init_miscdev();
+		if (rc) {
+			break;
+		}
+		stage = 4;
 
-		
+		//mounts are possible from here, everything they use is set up
+		rc = register_filesystem(&teadfs_fs_type);
+		if (rc) {
+			LOG_ERR("Failed to register filesystem\n");
+			break;
+		}
     } while (0);
-    LOG_DBG("LEVAL\n");
-    return 0;
+	if (rc) {
+		if (stage >= 4)
+			teadfs_destroy_miscdev();
+		if (stage >= 3)
+			teadfs_release_user_com();
+		if (stage >= 2)
+			teadfs_release_netlink();
+		teadfs_release_global_param();
+	}
+    LOG_DBG("LEVAL rc : [%d]\n", rc);
+	if (rc) {
+		teadfs_log_release();
+	}
+    return rc;
 }
  
 static void __exit teadfs_module_exit(void) {
     LOG_DBG("ENTRY\n");
     unregister_filesystem(&teadfs_fs_type);
 
+	teadfs_release_user_com();
+
 	teadfs_release_netlink();
 
 	teadfs_destroy_miscdev();
+
+	teadfs_release_global_param();
     LOG_DBG("LEVAL\n");
 
 	teadfs_log_release();
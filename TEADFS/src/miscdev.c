@@ -17,6 +17,9 @@
 #include <linux/ip.h>
 #include <linux/netlink.h>
 #include <linux/spinlock.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/uaccess.h>
 #include <net/sock.h>
 
 
@@ -27,12 +30,8 @@ teadfs_miscdev_open(struct inode* inode, struct file* file) {
 
 	LOG_DBG("ENTRY \n");
 	do {
-		rc = teadfs_get_client_connect();
-		if (rc) {
-			rc = -EBUSY;
-			break;
-		}
-		teadfs_set_clinet_connect(1);
+		//one daemon per session, the session is picked by PR_MSG_HELLO
+		file->private_data = (void*)(long)task_tgid_vnr(current);
 	} while (0);
 
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
@@ -47,7 +46,8 @@ teadfs_miscdev_release(struct inode* inode, struct file* file)
 
 	LOG_DBG("ENTRY \n");
 	do {
-		teadfs_set_clinet_connect(0);
+		//daemon exited or closed the device, fail its upcalls
+		teadfs_unbind_session_pid((pid_t)(long)file->private_data);
 	} while (0);
 
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
@@ -79,6 +79,72 @@ teadfs_miscdev_poll(struct file* file, poll_table* pt) {
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
+/**
+ * teadfs_miscdev_take_fd
+ * @arg: user pointer to the fd_token of an open or release upcall
+ *
+ * Open the lower file granted with the token in the calling daemon, the
+ * way fanotify hands out event fds. The file is opened with the daemon
+ * credentials and never goes through teadfs. Returns the new fd.
+ */
+static long teadfs_miscdev_take_fd(unsigned long arg) {
+	struct teadfs_session* session = NULL;
+	struct file* lower_file;
+	struct path path;
+	__u64 token;
+	int flags = 0;
+	long rc = 0;
+	int fd;
+
+	LOG_DBG("ENTRY \n");
+	do {
+		if (copy_from_user(&token, (void __user*)arg, sizeof(token))) {
+			rc = -EFAULT;
+			break;
+		}
+		//only the bound daemon takes fds of its session
+		session = teadfs_find_session_pid(task_tgid_vnr(current));
+		if (!session) {
+			rc = -EPERM;
+			break;
+		}
+		rc = teadfs_claim_fd(session, token, &path, &flags);
+		if (rc) {
+			break;
+		}
+		fd = get_unused_fd_flags(O_CLOEXEC);
+		if (fd < 0) {
+			path_put(&path);
+			rc = fd;
+			break;
+		}
+		lower_file = dentry_open(&path, flags | O_LARGEFILE, current_cred());
+		path_put(&path);
+		if (IS_ERR(lower_file)) {
+			put_unused_fd(fd);
+			rc = PTR_ERR(lower_file);
+			break;
+		}
+		fd_install(fd, lower_file);
+		rc = fd;
+	} while (0);
+	if (session) {
+		teadfs_put_session(session);
+	}
+	LOG_DBG("LEVAL rc : [%ld]\n", rc);
+	return rc;
+}
+
+static long
+teadfs_miscdev_ioctl(struct file* file, unsigned int cmd, unsigned long arg) {
+	switch (cmd) {
+	case TEADFS_IOC_TAKE_FD:
+		return teadfs_miscdev_take_fd(arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
 static const struct file_operations teadfs_miscdev_fops = {
 	.owner = THIS_MODULE,
 	.open = teadfs_miscdev_open,
@@ -86,6 +152,7 @@ static const struct file_operations teadfs_miscdev_fops = {
 	.release = teadfs_miscdev_release,
 	.read = teadfs_miscdev_read,
 	.write = teadfs_miscdev_write,
+	.unlocked_ioctl = teadfs_miscdev_ioctl,
 	.llseek = noop_llseek
 };
 
@@ -100,7 +167,6 @@ int teadfs_init_miscdev(void)
 	int rc;
 
 	LOG_DBG("ENTRY \n");
-	teadfs_set_clinet_connect(0);
 	rc = misc_register(&teadfs_miscdev);
 	if (rc)
 		LOG_ERR( "%s: Failed to register miscellaneous device "
@@ -4,15 +4,344 @@
 #include "mem.h"
 #include "protocol.h"
 #include "file.h"
+#include "teadfs_trace.h"
+#include "cache.h"
 
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/fs_stack.h>
+#include <linux/writeback.h>
+#include <linux/aio.h>
+#include <linux/uio.h>
+#include <linux/falloc.h>
 
 
 #define ENCRYPT_FILE_HEADER_SIZE 256
 
+/* a task faulting a page of the inode in, see teadfs_vm_fault */
+struct teadfs_fault_task {
+	struct list_head list;
+	struct task_struct* task;
+};
+
+//current is reading pages for a fault of the inode
+static int teadfs_in_fault(struct inode* inode)
+{
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	struct teadfs_fault_task* iter;
+	int rc = 0;
+
+	if (list_empty(&inode_info->faulting))
+		return 0;
+	spin_lock(&inode->i_lock);
+	list_for_each_entry(iter, &inode_info->faulting, list) {
+		if (iter->task == current) {
+			rc = 1;
+			break;
+		}
+	}
+	spin_unlock(&inode->i_lock);
+	return rc;
+}
+
+/**
+ * teadfs_lower_hole
+ * @inode: The teadfs inode
+ * @lower_file: The lower file
+ * @offset: Byte offset in the lower file
+ * @size: Length of the range
+ *
+ * SEEK_DATA takes the lower i_mutex, so it is only asked when the lower
+ * file has fewer blocks than its size, and never while faulting under
+ * mmap_sem. A hole missed that way is read and decrypted as data.
+ *
+ * Returns the bytes of the range below the lower i_size when the lower
+ * filesystem has no data allocated there; zero otherwise
+ */
+static size_t teadfs_lower_hole(struct inode* inode, struct file* lower_file, loff_t offset, size_t size)
+{
+	struct inode* lower_inode = file_inode(lower_file);
+	loff_t i_size = i_size_read(lower_inode);
+	loff_t data;
+
+	if (offset >= i_size)
+		return 0;
+	if (((loff_t)lower_inode->i_blocks << 9) >= i_size || teadfs_in_fault(inode))
+		return 0;
+	//the lower file is private to teadfs, its f_pos is not used
+	data = vfs_llseek(lower_file, offset, SEEK_DATA);
+	if (-ENXIO == data)
+		data = i_size;
+	if (data < 0 || data < min_t(loff_t, offset + size, i_size))
+		return 0;
+	return min_t(loff_t, size, i_size - offset);
+}
+
+/**
+ * teadfs_lower_drop_behind
+ * @sb: The teadfs super block
+ * @lower_file: The lower file
+ * @offset: Byte offset in the lower file of the ciphertext just moved
+ * @size: Length of the range
+ * @written: The range was written, start its writeback first
+ *
+ * With the lower_nocache mount option the ciphertext is not kept in
+ * the lower page cache next to the decrypted copy in i_decrypt. The
+ * header shifts the ranges off page boundaries, so the last lower page
+ * is shared with the next range and is kept for it. Pages still dirty
+ * or under writeback stay until a later pass or release.
+ */
+void teadfs_lower_drop_behind(struct super_block* sb, struct file* lower_file,
+	loff_t offset, size_t size, int written)
+{
+	pgoff_t first = offset >> PAGE_CACHE_SHIFT;
+	pgoff_t end = (offset + size) >> PAGE_CACHE_SHIFT;
+	unsigned long dropped;
+
+	if (!teadfs_get_super_block(sb)->opts.lower_nocache || end <= first)
+		return;
+	if (written)
+		filemap_fdatawrite_range(lower_file->f_mapping, offset, offset + size - 1);
+	dropped = invalidate_mapping_pages(lower_file->f_mapping, first, end - 1);
+	if (dropped)
+		teadfs_stats_add(sb, TS_LOWER_DROP, dropped);
+}
+
+//a page newly read into the decrypt view counts against the decrypt_budget
+static void teadfs_decrypt_page_added(struct page* page) {
+	struct inode* inode = page->mapping->host;
+
+	if (page->mapping == &teadfs_inode_to_private(inode)->i_decrypt)
+		teadfs_decrypt_cache_touch(inode);
+}
+
+//the other pages of a decoded extent go to the page cache while the plaintext is at hand
+static void teadfs_fill_extent(struct address_space* mapping, loff_t start, const char* plain, size_t len)
+{
+	struct page* page;
+	char* virt;
+	size_t off;
+	size_t n;
+
+	for (off = 0; off < len; off += PAGE_CACHE_SIZE) {
+		//the page being read is locked, and skipped
+		page = grab_cache_page_nowait(mapping, (start + off) >> PAGE_CACHE_SHIFT);
+		if (!page)
+			continue;
+		if (!PageUptodate(page)) {
+			n = min_t(size_t, PAGE_CACHE_SIZE, len - off);
+			virt = kmap(page);
+			memcpy(virt, plain + off, n);
+			if (n < PAGE_CACHE_SIZE)
+				memset(virt + n, 0, PAGE_CACHE_SIZE - n);
+			kunmap(page);
+			flush_dcache_page(page);
+			SetPageUptodate(page);
+			teadfs_decrypt_page_added(page);
+		}
+		unlock_page(page);
+		page_cache_release(page);
+	}
+}
+
+/**
+ * teadfs_read_extents
+ * @inode: The teadfs inode of a format 3 file
+ * @lower_file: The lower file
+ * @fill: Mapping the rest of each decoded extent is added to, may be NULL
+ * @offset: Plaintext offset to read from
+ * @data: The plaintext is stored here
+ * @size: Bytes to read
+ *
+ * An extent of a format 3 file may be stored compressed, so its whole
+ * slot is read and decoded, and the requested part copied out.
+ *
+ * Returns bytes read on success; 0 on EOF; less than zero on error
+ */
+static ssize_t teadfs_read_extents(struct inode* inode, struct file* lower_file,
+	struct address_space* fill, loff_t offset, char* data, size_t size)
+{
+	size_t extent_size = 1 << teadfs_inode_to_private(inode)->extent_shift;
+	loff_t plain_size = i_size_read(file_inode(lower_file)) - ENCRYPT_FILE_HEADER_SIZE;
+	char* slot = NULL;
+	char* plain = NULL;
+	size_t done = 0;
+	size_t skip;
+	size_t chunk;
+	size_t len;
+	loff_t start;
+	loff_t lower;
+	ssize_t rc = 0;
+
+	LOG_DBG("ENTRY offset:%lld size:%zu\n", offset, size);
+	do {
+		if (offset >= plain_size)
+			break;
+		size = min_t(loff_t, size, plain_size - offset);
+		slot = (char*)__get_free_pages(GFP_NOFS, get_order(extent_size));
+		plain = (char*)__get_free_pages(GFP_NOFS, get_order(extent_size));
+		if (!slot || !plain) {
+			rc = -ENOMEM;
+			break;
+		}
+		while (done < size) {
+			start = (offset + done) & ~((loff_t)extent_size - 1);
+			len = min_t(loff_t, extent_size, plain_size - start);
+			skip = offset + done - start;
+			chunk = min(size - done, len - skip);
+			lower = start + ENCRYPT_FILE_HEADER_SIZE;
+			if (teadfs_lower_hole(inode, lower_file, lower, len) == len) {
+				memset(plain, 0, len);
+				teadfs_stats_add(inode->i_sb, TS_BYTES_HOLE, len);
+			} else {
+				rc = kernel_read(lower_file, lower, slot, len);
+				if (rc < 0)
+					break;
+				//the tail of a compressed slot may be a hole, or cut by a racing truncate
+				if (rc < len)
+					memset(slot + rc, 0, len - rc);
+				teadfs_lower_drop_behind(inode->i_sb, lower_file, lower, len, 0);
+				rc = teadfs_request_read(inode, lower, slot, len, plain, extent_size);
+				if (rc != len) {
+					rc = (rc < 0) ? rc : -EIO;
+					break;
+				}
+			}
+			memcpy(data + done, plain + skip, chunk);
+			if (fill)
+				teadfs_fill_extent(fill, start, plain, len);
+			done += chunk;
+			rc = 0;
+		}
+	} while (0);
+
+	if (slot)
+		free_pages((unsigned long)slot, get_order(extent_size));
+	if (plain)
+		free_pages((unsigned long)plain, get_order(extent_size));
+	if (done)
+		rc = done;
+	LOG_DBG("LEVAL rc : [%zd]\n", rc);
+	return rc;
+}
+
+//give the slot tail behind a compressed extent back to the lower filesystem
+static void teadfs_lower_punch(struct file* lower_file, loff_t offset, loff_t len)
+{
+	if (lower_file->f_op && lower_file->f_op->fallocate)
+		lower_file->f_op->fallocate(lower_file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+}
+
+/**
+ * teadfs_write_extents
+ * @inode: The teadfs inode of a format 3 file
+ * @lower_file: The lower file
+ * @offset: Plaintext offset to write to
+ * @data: Plaintext to write
+ * @size: Bytes to write
+ * @eof: Plaintext size once the write is done, zero when the write
+ *       only grows the file
+ *
+ * Every extent touched is encoded whole, the part not written is read
+ * back first. A full extent the lower file already reaches past may be
+ * stored compressed in the head of its slot, and the rest of the slot
+ * is punched. The last extent is always stored as is, so the plaintext
+ * size stays the lower size less the header. Extents are written last
+ * first, so a file growing by several extents can compress all but the
+ * last of them. The caller holds the inode's extent_mutex, writeback
+ * runs without i_mutex and would merge into stale extents.
+ *
+ * Returns bytes written on success; less than zero on error
+ */
+static ssize_t __teadfs_write_extents(struct inode* inode, struct file* lower_file,
+	loff_t offset, const char* data, size_t size, loff_t eof)
+{
+	size_t extent_size = 1 << teadfs_inode_to_private(inode)->extent_shift;
+	loff_t first = offset & ~((loff_t)extent_size - 1);
+	loff_t start = (offset + size - 1) & ~((loff_t)extent_size - 1);
+	loff_t lower_size;
+	loff_t lower;
+	loff_t from;
+	loff_t to;
+	size_t old_len;
+	size_t len;
+	size_t stored;
+	char* slot = NULL;
+	char* plain = NULL;
+	ssize_t rc = 0;
+
+	LOG_DBG("ENTRY offset:%lld size:%zu eof:%lld\n", offset, size, eof);
+	do {
+		if (!size)
+			break;
+		if (!eof)
+			eof = max_t(loff_t, offset + size, i_size_read(file_inode(lower_file)) - ENCRYPT_FILE_HEADER_SIZE);
+		slot = (char*)__get_free_pages(GFP_NOFS, get_order(extent_size));
+		plain = (char*)__get_free_pages(GFP_NOFS, get_order(extent_size));
+		if (!slot || !plain) {
+			rc = -ENOMEM;
+			break;
+		}
+		for (;; start -= extent_size) {
+			lower = start + ENCRYPT_FILE_HEADER_SIZE;
+			lower_size = i_size_read(file_inode(lower_file));
+			from = max(offset, start);
+			to = min_t(loff_t, offset + size, start + extent_size);
+			old_len = clamp_t(loff_t, min(lower_size - ENCRYPT_FILE_HEADER_SIZE, eof) - start, 0, extent_size);
+			len = max_t(size_t, old_len, to - start);
+			if (from > start || to - start < old_len) {
+				memset(plain, 0, len);
+				rc = teadfs_read_extents(inode, lower_file, NULL, start, plain, old_len);
+				if (rc < 0)
+					break;
+			}
+			memcpy(plain + (from - start), data + (from - offset), to - from);
+			rc = teadfs_request_write_extent(inode, start, plain, len, slot, extent_size,
+				len == extent_size && start + extent_size < eof && lower + extent_size <= lower_size);
+			if (rc < 0 || rc > len) {
+				rc = -EIO;
+				break;
+			}
+			stored = rc;
+			rc = kernel_write(lower_file, slot, stored, lower);
+			if (rc < 0) {
+				LOG_ERR("kernel_write error:%zd\n", rc);
+				break;
+			}
+			if (stored < len) {
+				teadfs_lower_punch(lower_file, lower + stored, extent_size - stored);
+				teadfs_stats_add(inode->i_sb, TS_BYTES_COMPRESS_SAVED, len - stored);
+			}
+			teadfs_lower_drop_behind(inode->i_sb, lower_file, lower, stored, 1);
+			rc = 0;
+			if (start <= first)
+				break;
+		}
+	} while (0);
+
+	if (slot)
+		free_pages((unsigned long)slot, get_order(extent_size));
+	if (plain)
+		free_pages((unsigned long)plain, get_order(extent_size));
+	if (!rc)
+		rc = size;
+	LOG_DBG("LEVAL rc : [%zd]\n", rc);
+	return rc;
+}
+
+static ssize_t teadfs_write_extents(struct inode* inode, struct file* lower_file,
+	loff_t offset, const char* data, size_t size, loff_t eof)
+{
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	ssize_t rc;
+
+	mutex_lock(&inode_info->extent_mutex);
+	rc = __teadfs_write_extents(inode, lower_file, offset, data, size, eof);
+	mutex_unlock(&inode_info->extent_mutex);
+	return rc;
+}
+
 /**
  * teadfs_read_lower
  * @data: The read data is stored here by this function
@@ -41,8 +370,23 @@ int teadfs_read_lower(char* data, loff_t offset, size_t size,
 			rc = -EIO;
 			break;
 		}
+		if (OFR_DECRYPT == file_info->access && teadfs_inode_to_private(file_inode(file))->extent_compress) {
+			rc = teadfs_read_extents(file_inode(file), file_info->lower_file,
+				(file->f_mapping == &teadfs_inode_to_private(file_inode(file))->i_decrypt) ? file->f_mapping : NULL,
+				offset, data, size);
+			if (rc >= 0 && rc < size)
+				memset(data + rc, 0, size - rc);
+			break;
+		}
 		if (OFR_DECRYPT == file_info->access) {
 			offset += ENCRYPT_FILE_HEADER_SIZE;
+			//a hole reads as zeros, nothing to decrypt
+			rc = teadfs_lower_hole(file_inode(file), file_info->lower_file, offset, size);
+			if (rc > 0) {
+				memset(data, 0, size);
+				teadfs_stats_add(file_inode(file)->i_sb, TS_BYTES_HOLE, rc);
+				break;
+			}
 		}
 		// read
 		rc = kernel_read(file_info->lower_file, offset, data, size);
@@ -50,10 +394,11 @@ int teadfs_read_lower(char* data, loff_t offset, size_t size,
 			LOG_ERR("kernel_read error:%d\n", file, file_info->lower_file);
 			break;
 		}
-		LOG_INF("size:%d, offset:%lld  rc:%d %s\n", size, offset, rc, dentry->d_name.name);
+		LOG_DBG("size:%d, offset:%lld  rc:%d %s\n", size, offset, rc, dentry->d_name.name);
 		//encrypt file, will send to user mode
 		if (OFR_DECRYPT == file_info->access) {
-			encrypt_len = teadfs_request_read(offset, data, rc, data, size);
+			teadfs_lower_drop_behind(file_inode(file)->i_sb, file_info->lower_file, offset, rc, 0);
+			encrypt_len = teadfs_request_read(file_inode(file), offset, data, rc, data, size);
 			if (encrypt_len <= 0) {
 				break;
 			}
@@ -105,9 +450,16 @@ int teadfs_write_lower(struct file* file, char* data,
 			rc = -EIO;
 			break;
 		}
+		if (OFR_DECRYPT == file_info->access && teadfs_inode_to_private(file->f_inode)->extent_compress) {
+			rc = teadfs_write_extents(file->f_inode, file_info->lower_file, offset, data, size, 0);
+			if (rc < 0)
+				break;
+			mark_inode_dirty_sync(file->f_inode);
+			break;
+		}
 		//send to user mode
 		if (OFR_DECRYPT == file_info->access) {
-			encrypt_len = teadfs_request_write(offset, data, size, buf, size);
+			encrypt_len = teadfs_request_write(file->f_inode, offset, data, size, buf, size);
 			if (encrypt_len < 0) {
 				rc = -EIO;
 				break;
@@ -117,19 +469,21 @@ int teadfs_write_lower(struct file* file, char* data,
 			offset += ENCRYPT_FILE_HEADER_SIZE;
 		}
 		//write data to file
-		LOG_INF("size:%d, offset:%lld %s\n", size, offset, dentry->d_name.name);
+		LOG_DBG("size:%d, offset:%lld %s\n", size, offset, dentry->d_name.name);
 		rc = kernel_write(file_info->lower_file, data, size, offset);
 		if (rc < 0) {
 			LOG_ERR("kernel_read error:%d\n", file, file_info->lower_file);
 			break;
 		}
+		if (OFR_DECRYPT == file_info->access) {
+			teadfs_lower_drop_behind(file->f_inode->i_sb, file_info->lower_file, offset, rc, 1);
+		}
 		mark_inode_dirty_sync(file->f_inode);
 	} while (0);
 
 	if (buf) {
 		teadfs_free(buf);
 	}
-	LOG_INF("LEVAL rc : [%d]\n", rc);
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
@@ -159,10 +513,13 @@ static int teadfs_readpage(struct file* file, struct page* page)
 		kunmap(page);
 		flush_dcache_page(page);
 
-		if (rc)
+		if (rc) {
 			ClearPageUptodate(page);
-		else
+		} else {
 			SetPageUptodate(page);
+			teadfs_decrypt_page_added(page);
+		}
+		trace_teadfs_readpage(page->mapping->host, page->index, rc);
 		unlock_page(page);
 	} while (0);
 
@@ -170,6 +527,98 @@ static int teadfs_readpage(struct file* file, struct page* page)
 	return rc;
 }
 
+//pages read by readpages with one lower read and one upcall, as many as fit a message with its packet.
+//at least one, with 64K pages nothing fits and a unit is a single page like readpage
+#define TEADFS_READ_UNIT_FIT ((TEADFS_MSG_MAX_SIZE - sizeof(struct teadfs_packet_info)) >> PAGE_CACHE_SHIFT)
+#define TEADFS_READ_UNIT_PAGES (TEADFS_READ_UNIT_FIT ? TEADFS_READ_UNIT_FIT : 1)
+
+/**
+ * teadfs_read_unit
+ * @file: The teadfs file
+ * @pages: Locked pages of contiguous indexes, in the page cache
+ * @nr_pages: Count of @pages
+ *
+ * Read the pages with one call to teadfs_read_lower and unlock them.
+ * Pages not read are left not uptodate for readpage to retry.
+ */
+static void teadfs_read_unit(struct file* file, struct page** pages, int nr_pages)
+{
+	size_t size = nr_pages << PAGE_CACHE_SHIFT;
+	char* buf;
+	char* virt;
+	int rc;
+	int i;
+
+	buf = (char*)__get_free_pages(GFP_KERNEL | __GFP_NOWARN, get_order(size));
+	if (buf) {
+		rc = teadfs_read_lower(buf, ((loff_t)pages[0]->index) << PAGE_CACHE_SHIFT, size, file);
+	} else {
+		rc = -ENOMEM;
+	}
+	if (rc >= 0 && rc < size)
+		memset(buf + rc, 0, size - rc);
+	trace_teadfs_readpage(pages[0]->mapping->host, pages[0]->index, rc < 0 ? rc : 0);
+	for (i = 0; i < nr_pages; i++) {
+		if (rc >= 0) {
+			virt = kmap(pages[i]);
+			memcpy(virt, buf + (i << PAGE_CACHE_SHIFT), PAGE_CACHE_SIZE);
+			kunmap(pages[i]);
+			flush_dcache_page(pages[i]);
+			SetPageUptodate(pages[i]);
+			teadfs_decrypt_page_added(pages[i]);
+		}
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	if (buf)
+		free_pages((unsigned long)buf, get_order(size));
+}
+
+/**
+ * teadfs_readpages
+ * @file: The teadfs file
+ * @mapping: The upper mapping, i_data or i_decrypt
+ * @pages: Readahead pages, last index first
+ * @nr_pages: Count of @pages
+ *
+ * Readahead is read in units of up to TEADFS_READ_UNIT_PAGES contiguous
+ * pages, so the lower read, the upcall and the transform run once per
+ * unit instead of once per page.
+ *
+ * Returns zero
+ */
+static int teadfs_readpages(struct file* file, struct address_space* mapping,
+	struct list_head* pages, unsigned nr_pages)
+{
+	struct page* unit[TEADFS_READ_UNIT_PAGES];
+	struct page* page;
+	int nr_unit = 0;
+	unsigned i;
+
+	LOG_DBG("ENTRY nr_pages:%u\n", nr_pages);
+	if (!file)
+		return 0;
+	for (i = 0; i < nr_pages; i++) {
+		page = list_entry(pages->prev, struct page, lru);
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index, GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+		//the unit ends at a gap or when full
+		if (nr_unit && (nr_unit == TEADFS_READ_UNIT_PAGES
+			|| unit[nr_unit - 1]->index + 1 != page->index)) {
+			teadfs_read_unit(file, unit, nr_unit);
+			nr_unit = 0;
+		}
+		unit[nr_unit++] = page;
+	}
+	if (nr_unit)
+		teadfs_read_unit(file, unit, nr_unit);
+	LOG_DBG("LEVAL\n");
+	return 0;
+}
+
 /**
  * ecryptfs_get_locked_page
  *
@@ -237,22 +686,29 @@ static int teadfs_write(struct dentry* dentry, struct inode* ecryptfs_inode, cha
 		else
 			pos = offset;
 
-		file_info.access = teadfs_request_open_path(&lower_path);
+		file_info.access = teadfs_request_open_path(ecryptfs_inode, dentry, &lower_path);
 		file_info.lower_file = teadfs_get_lower_file(dentry, NULL, flags);
-		LOG_INF("lower_file:%px, access:%d\n", file_info.lower_file, file_info.access);
+		LOG_DBG("lower_file:%px, access:%d\n", file_info.lower_file, file_info.access);
 		if (IS_ERR(file_info.lower_file)) {
 			rc = PTR_ERR(file_info.lower_file);
 			LOG_ERR("%s: Error encrypting "
 				"page; rc = [%d]\n", __func__, rc);
 			break;
 		}
+		if (OFR_DECRYPT == file_info.access) {
+			rc = teadfs_read_file_header(ecryptfs_inode, file_info.lower_file);
+			if (rc) {
+				teadfs_put_lower_file(NULL, &file);
+				break;
+			}
+		}
 		rc = teadfs_write_lower(&file, data, pos, size);
 		if (rc < 0) {
 			LOG_ERR("%s: Error write "
 				"page; rc = [%d]\n", __func__, rc);
 			break;
 		}
-		LOG_INF("teadfs_write_lower rc : [%d]\n", rc);
+		LOG_DBG("teadfs_write_lower rc : [%d]\n", rc);
 		teadfs_put_lower_file(NULL, &file);
 		if (rc < 0) {
 			LOG_ERR("kernel_read error:%d\n", file, rc);
@@ -262,7 +718,7 @@ static int teadfs_write(struct dentry* dentry, struct inode* ecryptfs_inode, cha
 		if (pos > ecryptfs_file_size) {
 			i_size_write(ecryptfs_inode, pos);
 		}
-		LOG_INF("pos :%lld  size : [%d]  ecryptfs_file_size:%lld\n", pos, size, ecryptfs_file_size);
+		LOG_DBG("pos :%lld  size : [%d]  ecryptfs_file_size:%lld\n", pos, size, ecryptfs_file_size);
 		rc = 0;
 	} while (0);
 	teadfs_put_lower_path(dentry, &lower_path);
@@ -270,6 +726,77 @@ static int teadfs_write(struct dentry* dentry, struct inode* ecryptfs_inode, cha
 	return rc;
 }
 
+/**
+ * teadfs_truncate_extent
+ * @dentry: The teadfs dentry
+ * @inode: Its inode
+ * @new_size: Size the file is cut to
+ *
+ * The extent of a format 3 file holding the new end of file may be
+ * stored compressed, and cutting its slot would lose it. It is stored
+ * as is first, so the lower truncate only drops plaintext bytes.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+static int teadfs_truncate_extent(struct dentry* dentry, struct inode* inode, loff_t new_size)
+{
+	struct teadfs_file_info file_info = { 0 };
+	struct file file = { 0 };
+	struct path lower_path;
+	loff_t plain = new_size - ENCRYPT_FILE_HEADER_SIZE;
+	size_t extent_size = 0;
+	loff_t start;
+	char* buf = NULL;
+	int rc = 0;
+
+	LOG_DBG("ENTRY new_size:%lld\n", new_size);
+	teadfs_get_lower_path(dentry, &lower_path);
+	do {
+		if (plain <= 0 || teadfs_get_super_block(inode->i_sb)->opts.format < TEADFS_FORMAT_V3)
+			break;
+		file.f_path.dentry = dentry;
+		file.f_inode = inode;
+		teadfs_set_file_private(&file, &file_info);
+		file_info.access = teadfs_request_open_path(inode, dentry, &lower_path);
+		if (OFR_DECRYPT != file_info.access)
+			break;
+		file_info.lower_file = teadfs_get_lower_file(dentry, NULL, O_RDWR);
+		if (IS_ERR(file_info.lower_file)) {
+			rc = PTR_ERR(file_info.lower_file);
+			file_info.lower_file = NULL;
+			break;
+		}
+		rc = teadfs_read_file_header(inode, file_info.lower_file);
+		if (rc || !teadfs_inode_to_private(inode)->extent_compress)
+			break;
+		extent_size = 1 << teadfs_inode_to_private(inode)->extent_shift;
+		start = plain & ~((loff_t)extent_size - 1);
+		if (start == plain)
+			break;
+		buf = (char*)__get_free_pages(GFP_KERNEL, get_order(extent_size));
+		if (!buf) {
+			rc = -ENOMEM;
+			break;
+		}
+		//the extent is read and written back as one
+		mutex_lock(&teadfs_inode_to_private(inode)->extent_mutex);
+		rc = teadfs_read_extents(inode, file_info.lower_file, NULL, start, buf, plain - start);
+		if (rc >= 0)
+			rc = __teadfs_write_extents(inode, file_info.lower_file, start, buf, plain - start, plain);
+		mutex_unlock(&teadfs_inode_to_private(inode)->extent_mutex);
+		if (rc > 0)
+			rc = 0;
+	} while (0);
+
+	if (buf)
+		free_pages((unsigned long)buf, get_order(extent_size));
+	if (file_info.lower_file)
+		teadfs_put_lower_file(NULL, &file);
+	teadfs_put_lower_path(dentry, &lower_path);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
 /**
  * truncate_upper
  * @dentry: The ecryptfs layer dentry
@@ -337,6 +864,9 @@ int truncate_upper(struct dentry* dentry, struct iattr* ia,
 		  * in which ia->ia_size is located. Fill in the end of
 		  * that page from (ia->ia_size & ~PAGE_CACHE_MASK) to
 		  * PAGE_CACHE_SIZE with zeros. */
+			rc = teadfs_truncate_extent(dentry, inode, ia->ia_size);
+			if (rc)
+				break;
 			truncate_setsize(inode, ia->ia_size);
 			lower_ia->ia_size = ia->ia_size;
 			lower_ia->ia_valid |= ATTR_SIZE;
@@ -409,7 +939,7 @@ static int treadfs_write_begin(struct file* file,
 	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
 	struct dentry* teadfs_dentry = file->f_path.dentry;
 
-	LOG_INF("ENTRY file:%px name:%s\n", file, teadfs_dentry->d_name.name);
+	LOG_DBG("ENTRY file:%px name:%s\n", file, teadfs_dentry->d_name.name);
 
 
 	//find page. if not exist create page.
@@ -438,8 +968,10 @@ static int treadfs_write_begin(struct file* file,
 				ClearPageUptodate(page);
 				break;
 			}
-			else
+			else {
 				SetPageUptodate(page);
+				teadfs_decrypt_page_added(page);
+			}
 
 		}
 		/* If creating a page or more of holes, zero them out via truncate.
@@ -469,6 +1001,7 @@ static int treadfs_write_begin(struct file* file,
 		page_cache_release(page);
 		*pagep = NULL;
 	}
+	trace_teadfs_write_begin(mapping->host, pos, len, rc);
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
@@ -499,7 +1032,7 @@ static int teadfs_write_end(struct file* file,
 	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
 	struct dentry* teadfs_dentry = file->f_path.dentry;
 
-	LOG_INF("ENTRY file:%px pos:%lld, len:%d, copied:%d name:%s\n", file, pos, len, copied, teadfs_dentry->d_name.name);
+	LOG_DBG("ENTRY file:%px pos:%lld, len:%d, copied:%d name:%s\n", file, pos, len, copied, teadfs_dentry->d_name.name);
 
 	LOG_DBG("ENTRY\n");
 
@@ -524,12 +1057,250 @@ static int teadfs_write_end(struct file* file,
 		unlock_page(page);
 		page_cache_release(page);
 	} while (0);
+	trace_teadfs_write_end(ecryptfs_inode, pos, len, copied, rc);
 
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
 
 
+/* contiguous dirty pages are written back with one upcall and one lower write */
+#define TEADFS_WRITEBACK_BATCH_PAGES 8
+
+struct teadfs_writeback_batch {
+	struct inode* inode;
+	struct file* lower_file;
+	//pages of the decrypt view are encrypted before they reach the lower file
+	int transform;
+	//size of the data the mapping shows, pages past it are skipped
+	loff_t i_size;
+	pgoff_t index;
+	int nr_pages;
+	int max_pages;
+	size_t size;
+	char* buf;
+	char* transform_buf;
+	struct page* pages[TEADFS_WRITEBACK_BATCH_PAGES];
+};
+
+/**
+ * teadfs_writeback_init
+ * @batch: Batch to set up
+ * @mapping: The i_data or i_decrypt mapping being written back
+ * @max_pages: Largest number of pages to gather before a lower write
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+static int teadfs_writeback_init(struct teadfs_writeback_batch* batch,
+	struct address_space* mapping, int max_pages)
+{
+	struct inode* inode = mapping->host;
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	size_t buf_size;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->inode = inode;
+	batch->transform = (mapping == &inode_info->i_decrypt);
+	batch->i_size = i_size_read(inode);
+	if (batch->transform) {
+		batch->i_size -= ENCRYPT_FILE_HEADER_SIZE;
+	}
+	//fall back to single pages when memory is tight
+	for (batch->max_pages = max_pages; batch->max_pages > 0; batch->max_pages >>= 1) {
+		buf_size = (size_t)batch->max_pages << PAGE_CACHE_SHIFT;
+		batch->buf = teadfs_zalloc(buf_size, GFP_NOFS | __GFP_NOWARN);
+		if (batch->buf && batch->transform) {
+			batch->transform_buf = teadfs_zalloc(buf_size, GFP_NOFS | __GFP_NOWARN);
+			if (!batch->transform_buf) {
+				teadfs_free(batch->buf);
+				batch->buf = NULL;
+			}
+		}
+		if (batch->buf)
+			break;
+	}
+	if (!batch->buf)
+		return -ENOMEM;
+
+	mutex_lock(&inode_info->lower_file_mutex);
+	batch->lower_file = inode_info->mmap_lower_file;
+	if (batch->lower_file)
+		get_file(batch->lower_file);
+	mutex_unlock(&inode_info->lower_file_mutex);
+	return 0;
+}
+
+static void teadfs_writeback_release(struct teadfs_writeback_batch* batch)
+{
+	if (batch->lower_file)
+		fput(batch->lower_file);
+	if (batch->transform_buf)
+		teadfs_free(batch->transform_buf);
+	if (batch->buf)
+		teadfs_free(batch->buf);
+}
+
+/**
+ * teadfs_writeback_flush
+ * @batch: Pages gathered by teadfs_writeback_page
+ *
+ * Encrypt the gathered pages with one upcall when they belong to the
+ * decrypt view, write them to the lower file and end writeback on them.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+static int teadfs_writeback_flush(struct teadfs_writeback_batch* batch)
+{
+	loff_t offset = ((loff_t)batch->index) << PAGE_CACHE_SHIFT;
+	char* data = batch->buf;
+	size_t size = batch->size;
+	ssize_t rc = 0;
+	int i;
+
+	if (!batch->nr_pages)
+		return 0;
+
+	LOG_DBG("ENTRY index:%lu pages:%d\n", batch->index, batch->nr_pages);
+	do {
+		if (!batch->lower_file) {
+			rc = -EIO;
+			break;
+		}
+		if (batch->transform && teadfs_inode_to_private(batch->inode)->extent_compress) {
+			rc = teadfs_write_extents(batch->inode, batch->lower_file, offset, data, size, 0);
+			if (rc < 0)
+				break;
+			rc = 0;
+			break;
+		}
+		if (batch->transform) {
+			rc = teadfs_request_write(batch->inode, offset, data, size, batch->transform_buf, size);
+			if (rc < 0) {
+				rc = -EIO;
+				break;
+			}
+			data = batch->transform_buf;
+			size = rc;
+			offset += ENCRYPT_FILE_HEADER_SIZE;
+		}
+		rc = kernel_write(batch->lower_file, data, size, offset);
+		if (rc < 0) {
+			LOG_ERR("kernel_write error:%zd\n", rc);
+			break;
+		}
+		if (batch->transform) {
+			teadfs_lower_drop_behind(batch->inode->i_sb, batch->lower_file, offset, rc, 1);
+		}
+		rc = 0;
+	} while (0);
+
+	for (i = 0; i < batch->nr_pages; i++) {
+		if (rc) {
+			SetPageError(batch->pages[i]);
+			mapping_set_error(batch->pages[i]->mapping, rc);
+		}
+		end_page_writeback(batch->pages[i]);
+		page_cache_release(batch->pages[i]);
+	}
+	//the ciphertext view of these pages is stale now
+	if (!rc && batch->transform) {
+		//lower data is shifted by the header, it reaches one page further
+		invalidate_mapping_pages(batch->inode->i_mapping, batch->index,
+			batch->index + batch->nr_pages);
+	}
+	batch->nr_pages = 0;
+	batch->size = 0;
+	LOG_DBG("LEVAL rc : [%zd]\n", rc);
+	return rc;
+}
+
+/**
+ * teadfs_writeback_page
+ * @page: Locked dirty page, already cleared for io
+ * @wbc: Writeback control
+ * @data: The teadfs_writeback_batch gathering pages
+ *
+ * Copy the page into the batch, writing the batch out first when the
+ * page does not extend it.
+ *
+ * Returns zero; write errors are recorded on the mapping
+ */
+static int teadfs_writeback_page(struct page* page, struct writeback_control* wbc, void* data)
+{
+	struct teadfs_writeback_batch* batch = data;
+	pgoff_t end_index = batch->i_size >> PAGE_CACHE_SHIFT;
+	unsigned len = PAGE_CACHE_SIZE;
+	char* virt;
+
+	//page is outside the file, truncate will drop it
+	if (batch->i_size <= 0 || page->index > end_index
+		|| (page->index == end_index && !(batch->i_size & ~PAGE_CACHE_MASK))) {
+		unlock_page(page);
+		return 0;
+	}
+	if (page->index == end_index)
+		len = batch->i_size & ~PAGE_CACHE_MASK;
+	if (batch->nr_pages && (page->index != batch->index + batch->nr_pages
+		|| batch->nr_pages == batch->max_pages)) {
+		teadfs_writeback_flush(batch);
+	}
+	if (!batch->nr_pages)
+		batch->index = page->index;
+
+	set_page_writeback(page);
+	virt = kmap(page);
+	memcpy(batch->buf + ((size_t)batch->nr_pages << PAGE_CACHE_SHIFT), virt, len);
+	kunmap(page);
+	unlock_page(page);
+	page_cache_get(page);
+	batch->pages[batch->nr_pages++] = page;
+	batch->size = (((size_t)batch->nr_pages - 1) << PAGE_CACHE_SHIFT) + len;
+	return 0;
+}
+
+static int teadfs_writeback_mapping(struct address_space* mapping, struct writeback_control* wbc)
+{
+	struct teadfs_writeback_batch batch;
+	int rc;
+
+	rc = teadfs_writeback_init(&batch, mapping, TEADFS_WRITEBACK_BATCH_PAGES);
+	if (rc)
+		return rc;
+	rc = write_cache_pages(mapping, wbc, teadfs_writeback_page, &batch);
+	teadfs_writeback_flush(&batch);
+	teadfs_writeback_release(&batch);
+	return rc;
+}
+
+/**
+ * teadfs_writepages
+ * @mapping: The i_data or i_decrypt mapping of a teadfs inode
+ * @wbc: Writeback control
+ *
+ * Only shared writable mmap leaves dirty pages behind. The flusher only
+ * knows inode->i_mapping, so the decrypt view is written with it.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+static int teadfs_writepages(struct address_space* mapping, struct writeback_control* wbc)
+{
+	struct inode* inode = mapping->host;
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	int rc;
+	int decrypt_rc;
+
+	LOG_DBG("ENTRY\n");
+	rc = teadfs_writeback_mapping(mapping, wbc);
+	if (mapping == inode->i_mapping
+		&& mapping_tagged(&inode_info->i_decrypt, PAGECACHE_TAG_DIRTY)) {
+		decrypt_rc = teadfs_writeback_mapping(&inode_info->i_decrypt, wbc);
+		if (!rc)
+			rc = decrypt_rc;
+	}
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
 /**
  * teadfs_writepage
  * @page: Page that is locked before this call is made
@@ -537,20 +1308,373 @@ static int teadfs_write_end(struct file* file,
  * Returns zero on success; non-zero otherwise
  *
  * This is where we encrypt the data and pass the encrypted data to
- * the lower filesystem.  In OpenPGP-compatible mode, we operate on
- * entire underlying packets.
+ * the lower filesystem. Reclaim does not wait on the daemon, the page
+ * is left dirty for the flusher.
  */
 static int teadfs_writepage(struct page* page, struct writeback_control* wbc)
 {
+	struct teadfs_writeback_batch batch;
 	int rc;
+
 	LOG_DBG("ENTRY\n");
+	do {
+		if (wbc->for_reclaim) {
+			redirty_page_for_writepage(wbc, page);
+			unlock_page(page);
+			rc = 0;
+			break;
+		}
+		rc = teadfs_writeback_init(&batch, page->mapping, 1);
+		if (rc) {
+			redirty_page_for_writepage(wbc, page);
+			unlock_page(page);
+			break;
+		}
+		teadfs_writeback_page(page, wbc, &batch);
+		rc = teadfs_writeback_flush(&batch);
+		teadfs_writeback_release(&batch);
+	} while (0);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
 
-	SetPageUptodate(page);
-	unlock_page(page);
+/**
+ * teadfs_page_mkwrite
+ * @vma: The shared mapping being written
+ * @vmf: Fault with the page to make writable
+ *
+ * The ciphertext view cannot be edited, writes through it raise SIGBUS.
+ *
+ * Returns VM_FAULT_LOCKED with the page dirty on success
+ */
+static int teadfs_page_mkwrite(struct vm_area_struct* vma, struct vm_fault* vmf)
+{
+	struct page* page = vmf->page;
+	struct file* file = vma->vm_file;
+	struct inode* inode = file_inode(file);
+	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
+	struct path lower;
+	int rc = VM_FAULT_LOCKED;
+
+	LOG_DBG("ENTRY\n");
+	sb_start_pagefault(inode->i_sb);
+	file_update_time(file);
+	//tell user mode the file content changed, once per open as write does
+	if (OFR_ENCRYPT != file_info->access && !file_info->written) {
+		file_info->written = 1;
+		teadfs_get_lower_path(file->f_path.dentry, &lower);
+		teadfs_notify_event(TET_WRITE, inode, &lower, NULL);
+		teadfs_put_lower_path(file->f_path.dentry, &lower);
+	}
+	lock_page(page);
+	do {
+		// cann't edit file, in encrypt open.
+		if (OFR_ENCRYPT == file_info->access) {
+			unlock_page(page);
+			rc = VM_FAULT_SIGBUS;
+			break;
+		}
+		//truncated under us
+		if (page->mapping != file->f_mapping || page_offset(page) >= i_size_read(inode)) {
+			unlock_page(page);
+			rc = VM_FAULT_NOPAGE;
+			break;
+		}
+		set_page_dirty(page);
+		wait_for_stable_page(page);
+	} while (0);
+	sb_end_pagefault(inode->i_sb);
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
 
+/**
+ * teadfs_vm_open
+ * @vma: A copy of a shared writable mapping, split or forked
+ *
+ * The copy holds its own reference to the lower file.
+ */
+static void teadfs_vm_open(struct vm_area_struct* vma)
+{
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(file_inode(vma->vm_file));
+
+	if (!vma->vm_private_data)
+		return;
+	get_file(vma->vm_private_data);
+	mutex_lock(&inode_info->lower_file_mutex);
+	inode_info->mmap_count++;
+	mutex_unlock(&inode_info->lower_file_mutex);
+}
+
+/**
+ * teadfs_vm_close
+ * @vma: The mapping going away
+ *
+ * The last shared writable mapping of the inode writes its dirty pages
+ * back before the inode lets go of the lower file writeback uses.
+ */
+static void teadfs_vm_close(struct vm_area_struct* vma)
+{
+	struct inode* inode = file_inode(vma->vm_file);
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	struct file* lower_file = NULL;
+
+	if (!vma->vm_private_data)
+		return;
+	mutex_lock(&inode_info->lower_file_mutex);
+	//writeback takes the mutex, only this vma can still dirty pages
+	if (1 == inode_info->mmap_count) {
+		mutex_unlock(&inode_info->lower_file_mutex);
+		filemap_write_and_wait(&inode_info->i_decrypt);
+		filemap_write_and_wait(&inode->i_data);
+		mutex_lock(&inode_info->lower_file_mutex);
+	}
+	if (!--inode_info->mmap_count) {
+		lower_file = inode_info->mmap_lower_file;
+		inode_info->mmap_lower_file = NULL;
+	}
+	mutex_unlock(&inode_info->lower_file_mutex);
+	if (lower_file)
+		fput(lower_file);
+	fput(vma->vm_private_data);
+	vma->vm_private_data = NULL;
+}
+
+/**
+ * teadfs_vm_fault
+ * @vma: The mapping faulted on
+ * @vmf: The fault
+ *
+ * filemap_fault with current marked on the inode, the pages it reads
+ * skip the lower hole lookup.
+ */
+static int teadfs_vm_fault(struct vm_area_struct* vma, struct vm_fault* vmf)
+{
+	struct inode* inode = file_inode(vma->vm_file);
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	struct teadfs_fault_task fault_task = { .task = current };
+	int rc;
+
+	spin_lock(&inode->i_lock);
+	list_add(&fault_task.list, &inode_info->faulting);
+	spin_unlock(&inode->i_lock);
+	rc = filemap_fault(vma, vmf);
+	spin_lock(&inode->i_lock);
+	list_del(&fault_task.list);
+	spin_unlock(&inode->i_lock);
+	return rc;
+}
+
+const struct vm_operations_struct teadfs_file_vm_ops = {
+	.open = teadfs_vm_open,
+	.close = teadfs_vm_close,
+	.fault = teadfs_vm_fault,
+	.page_mkwrite = teadfs_page_mkwrite,
+#ifdef CONFIG_VM_REMAP_PAGES
+	.remap_pages = generic_file_remap_pages,
+#endif
+};
+
+
+/* direct io moves this much data per upcall and lower io */
+#define TEADFS_DIO_CHUNK_SIZE (32 * 1024)
+
+struct teadfs_dio_iter {
+	const struct iovec* iov;
+	unsigned long nr_segs;
+	size_t iov_offset;
+};
+
+/**
+ * teadfs_dio_copy
+ * @iter: Position in the user iovec
+ * @buf: Bounce buffer
+ * @len: Bytes to move
+ * @rw: READ copies @buf to user memory, WRITE copies user memory to @buf
+ *
+ * Returns zero on success; -EFAULT otherwise
+ */
+static int teadfs_dio_copy(struct teadfs_dio_iter* iter, char* buf, size_t len, int rw)
+{
+	size_t copy;
+	char __user* base;
+
+	while (len) {
+		if (!iter->nr_segs)
+			return -EFAULT;
+		copy = min(len, iter->iov->iov_len - iter->iov_offset);
+		base = iter->iov->iov_base + iter->iov_offset;
+		if (READ == rw ? copy_to_user(base, buf, copy) : copy_from_user(buf, base, copy))
+			return -EFAULT;
+		buf += copy;
+		len -= copy;
+		iter->iov_offset += copy;
+		if (iter->iov_offset == iter->iov->iov_len) {
+			iter->iov++;
+			iter->nr_segs--;
+			iter->iov_offset = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * teadfs_lower_rw
+ * @rw: READ or WRITE
+ * @lower_file: The lower file
+ * @iov: User buffers
+ * @nr_segs: Number of entries in @iov
+ * @ppos: Offset in the lower file, moved past the data on success
+ *
+ * Hand the user buffers to the lower file unchanged. Used where the
+ * offsets of both layers match: direct io of plain and ciphertext views,
+ * and the passthrough mount option.
+ *
+ * Returns bytes moved on success; less than zero on error
+ */
+ssize_t teadfs_lower_rw(int rw, struct file* lower_file,
+	const struct iovec* iov, unsigned long nr_segs, loff_t* ppos)
+{
+	struct kiocb kiocb;
+	size_t count = iov_length(iov, nr_segs);
+	ssize_t rc;
+
+	if (!lower_file->f_op)
+		return -EINVAL;
+	if ((READ == rw && !lower_file->f_op->aio_read) || (WRITE == rw && !lower_file->f_op->aio_write))
+		return -EINVAL;
+	init_sync_kiocb(&kiocb, lower_file);
+	kiocb.ki_pos = *ppos;
+	kiocb.ki_left = count;
+	kiocb.ki_nbytes = count;
+	if (READ == rw)
+		rc = lower_file->f_op->aio_read(&kiocb, iov, nr_segs, kiocb.ki_pos);
+	else
+		rc = lower_file->f_op->aio_write(&kiocb, iov, nr_segs, kiocb.ki_pos);
+	if (-EIOCBQUEUED == rc)
+		rc = wait_on_sync_kiocb(&kiocb);
+	if (rc > 0)
+		*ppos = kiocb.ki_pos;
+	return rc;
+}
+
+/**
+ * teadfs_direct_IO
+ * @rw: READ or WRITE
+ * @iocb: The request, ki_filp is the teadfs file
+ * @iov: User buffers
+ * @offset: Offset in the teadfs file
+ * @nr_segs: Number of entries in @iov
+ *
+ * The decrypt view is moved through a page aligned bounce buffer, one
+ * upcall per TEADFS_DIO_CHUNK_SIZE, and skips both page caches. Its
+ * lower offsets are shifted by the file header, so the lower file is
+ * opened without O_DIRECT for it.
+ *
+ * Returns bytes moved on success; less than zero on error
+ */
+ssize_t teadfs_direct_IO(int rw, struct kiocb* iocb, const struct iovec* iov,
+	loff_t offset, unsigned long nr_segs)
+{
+	struct file* file = iocb->ki_filp;
+	struct teadfs_file_info* file_info = teadfs_file_to_private(file);
+	struct inode* inode = file_inode(file);
+	struct teadfs_dio_iter iter = { .iov = iov, .nr_segs = nr_segs, .iov_offset = 0 };
+	size_t count = iov_length(iov, nr_segs);
+	size_t done = 0;
+	size_t chunk;
+	loff_t lower_offset;
+	char* buf = NULL;
+	ssize_t rc = 0;
+
+	LOG_DBG("ENTRY rw:%d offset:%lld count:%zu\n", rw, offset, count);
+	do {
+		if (!file_info || !file_info->lower_file) {
+			rc = -EIO;
+			break;
+		}
+		// cann't edit file, in encrypt open.
+		if (WRITE == rw && OFR_ENCRYPT == file_info->access) {
+			rc = -EIO;
+			break;
+		}
+		if (OFR_DECRYPT != file_info->access) {
+			lower_offset = offset;
+			rc = teadfs_lower_rw(rw, file_info->lower_file, iov, nr_segs, &lower_offset);
+			break;
+		}
+		buf = (char*)__get_free_pages(GFP_KERNEL, get_order(TEADFS_DIO_CHUNK_SIZE));
+		if (!buf) {
+			rc = -ENOMEM;
+			break;
+		}
+		while (done < count) {
+			chunk = min_t(size_t, count - done, TEADFS_DIO_CHUNK_SIZE);
+			lower_offset = offset + done + ENCRYPT_FILE_HEADER_SIZE;
+			if (READ == rw && teadfs_inode_to_private(inode)->extent_compress) {
+				rc = teadfs_read_extents(inode, file_info->lower_file, NULL, offset + done, buf, chunk);
+				if (rc <= 0)
+					break;
+				chunk = rc;
+				rc = teadfs_dio_copy(&iter, buf, chunk, READ);
+				if (rc)
+					break;
+			} else if (READ == rw) {
+				rc = kernel_read(file_info->lower_file, lower_offset, buf, chunk);
+				if (rc <= 0)
+					break;
+				teadfs_lower_drop_behind(inode->i_sb, file_info->lower_file, lower_offset, rc, 0);
+				rc = teadfs_request_read(inode, lower_offset, buf, rc, buf, TEADFS_DIO_CHUNK_SIZE);
+				if (rc <= 0) {
+					rc = rc ? rc : -EIO;
+					break;
+				}
+				chunk = min_t(size_t, chunk, rc);
+				rc = teadfs_dio_copy(&iter, buf, chunk, READ);
+				if (rc)
+					break;
+			} else if (teadfs_inode_to_private(inode)->extent_compress) {
+				rc = teadfs_dio_copy(&iter, buf, chunk, WRITE);
+				if (rc)
+					break;
+				rc = teadfs_write_extents(inode, file_info->lower_file, offset + done, buf, chunk, 0);
+				if (rc < 0)
+					break;
+			} else {
+				rc = teadfs_dio_copy(&iter, buf, chunk, WRITE);
+				if (rc)
+					break;
+				rc = teadfs_request_write(inode, offset + done, buf, chunk, buf, TEADFS_DIO_CHUNK_SIZE);
+				if (rc < 0) {
+					rc = -EIO;
+					break;
+				}
+				rc = kernel_write(file_info->lower_file, buf, rc, lower_offset);
+				if (rc < 0)
+					break;
+				teadfs_lower_drop_behind(inode->i_sb, file_info->lower_file, lower_offset, rc, 1);
+			}
+			done += chunk;
+			//end of file
+			if (READ == rw && chunk < TEADFS_DIO_CHUNK_SIZE && done < count)
+				break;
+		}
+		if (done) {
+			rc = done;
+		}
+		if (WRITE == rw && done) {
+			fsstack_copy_inode_size(inode, file_inode(file_info->lower_file));
+			//the ciphertext view is stale now
+			invalidate_mapping_pages(inode->i_mapping, 0, -1);
+		}
+	} while (0);
+
+	if (buf) {
+		free_pages((unsigned long)buf, get_order(TEADFS_DIO_CHUNK_SIZE));
+	}
+	LOG_DBG("LEVAL rc : [%zd]\n", rc);
+	return rc;
+}
 
 static sector_t teadfs_bmap(struct address_space* mapping, sector_t block)
 {
@@ -572,7 +1696,11 @@ static sector_t teadfs_bmap(struct address_space* mapping, sector_t block)
 
 const struct address_space_operations teadfs_aops = {
 	.writepage = teadfs_writepage,
+	.writepages = teadfs_writepages,
+	.set_page_dirty = __set_page_dirty_nobuffers,
+	.direct_IO = teadfs_direct_IO,
 	.readpage = teadfs_readpage,
+	.readpages = teadfs_readpages,
 	.write_begin = treadfs_write_begin,
 	.write_end = teadfs_write_end,
 	.bmap = teadfs_bmap,
@@ -5,6 +5,17 @@
 
 extern const struct address_space_operations teadfs_aops;
 
+extern const struct vm_operations_struct teadfs_file_vm_ops;
+
+ssize_t teadfs_lower_rw(int rw, struct file* lower_file,
+	const struct iovec* iov, unsigned long nr_segs, loff_t* ppos);
+
+void teadfs_lower_drop_behind(struct super_block* sb, struct file* lower_file,
+	loff_t offset, size_t size, int written);
+
+ssize_t teadfs_direct_IO(int rw, struct kiocb* iocb, const struct iovec* iov,
+	loff_t offset, unsigned long nr_segs);
+
 int truncate_upper(struct dentry* dentry, struct iattr* ia,
 	struct iattr* lower_ia);
 #endif // !MMAP_H
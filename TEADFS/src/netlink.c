@@ -4,6 +4,7 @@
 #include "mem.h"
 #include "global_param.h"
 #include "teadfs_header.h"
+#include "teadfs_trace.h"
 
 #include <linux/module.h>
 #include <linux/kernel.h>
@@ -32,7 +33,8 @@ struct
 	rwlock_t lock;
 }user_proc;
 
-static void teadfs_user_request_kernel(struct teadfs_packet_info* packet_info) {
+//portid: netlink port of the sender, the daemon pid
+static void teadfs_user_request_kernel(struct teadfs_packet_info* packet_info, __u32 portid) {
 	struct teadfs_packet_info response_packet_info;
 
 	LOG_DBG("ENTRY\n");
@@ -41,16 +43,18 @@ static void teadfs_user_request_kernel(struct teadfs_packet_info* packet_info) {
 	case PR_MSG_HELLO: {
 		response_packet_info.header = packet_info->header;
 		response_packet_info.header.size = sizeof(struct teadfs_packet_info);
-		response_packet_info.data.code.error_code = 0;
 
-		LOG_DBG("hello: client pid :%d\n", packet_info->data.hello.pid);
-		teadfs_set_client_pid(packet_info->data.hello.pid);
-		teadfs_send_to_user((char*)&response_packet_info, response_packet_info.header.size);
+		LOG_DBG("hello: client pid :%d, port:%u, session:%u\n", packet_info->data.hello.pid, portid, packet_info->data.hello.session);
+		//bound to the port the kernel saw, not the pid the payload claims.
+		//a second daemon for a bound session is refused
+		response_packet_info.data.code.error_code = teadfs_bind_session(packet_info->data.hello.session, portid,
+			packet_info->data.hello.features);
+		teadfs_send_to_user(portid, (char*)&response_packet_info, response_packet_info.header.size);
 	}
 		break;
 	case PR_MSG_CLOSE:
 		LOG_DBG("close: client\n");
-		teadfs_set_client_pid(0);
+		teadfs_unbind_session_pid(portid);
 		break;
 	default:
 		break;
@@ -63,15 +67,22 @@ static void teadfs_netlink_receive(struct sk_buff *skb) {
 	struct nlmsghdr* nlmsghdr = nlmsg_hdr(skb);
 	struct teadfs_msg_ctx *msg_ctx = NULL;
 	struct teadfs_packet_info *packet_info = nlmsg_data(nlmsghdr);
+	struct teadfs_session* session;
 
 	LOG_DBG("ENTRY, size:%d\n", nlmsghdr->nlmsg_len);
 	// kernel request to user 
 	if (1 == packet_info->header.initiator) {
-		teadfs_user_request_kernel(packet_info);
+		teadfs_user_request_kernel(packet_info, NETLINK_CB(skb).portid);
 	} else { // user request to kernel
+		//only the queue of the session the sender is bound to
+		session = teadfs_find_session_pid(NETLINK_CB(skb).portid);
+		if (!session) {
+			LOG_ERR("answer from unbound port:%u\n", NETLINK_CB(skb).portid);
+			return;
+		}
 		// 
-		mutex_lock(&teadfs_get_msg_queue()->mux);
-		list_for_each_entry(msg_ctx, &(teadfs_get_msg_queue()->msg_ctx_queue), out_list) {
+		mutex_lock(&teadfs_get_msg_queue(session)->mux);
+		list_for_each_entry(msg_ctx, &(teadfs_get_msg_queue(session)->msg_ctx_queue), out_list) {
 			if (packet_info->header.msg_id == msg_ctx->msg_id) {
 				mutex_lock(&msg_ctx->mux);
 				do {
@@ -85,19 +96,21 @@ static void teadfs_netlink_receive(struct sk_buff *skb) {
 					msg_ctx->response_msg_size = nlmsg_len(nlmsghdr);
 					memcpy(msg_ctx->response_msg, packet_info, msg_ctx->response_msg_size);
 				} while (0);
+				trace_teadfs_upcall_reply(msg_ctx->msg_id, msg_ctx->msg_type, msg_ctx->response_msg_size, msg_ctx->ino);
 				wake_up(&(msg_ctx->wait));
 				mutex_unlock(&msg_ctx->mux);
 				break;
 			}
 		}
-		mutex_unlock(&teadfs_get_msg_queue()->mux);
+		mutex_unlock(&teadfs_get_msg_queue(session)->mux);
+		teadfs_put_session(session);
 	}
 	
 
 	LOG_DBG("LEVAL\n");
 }
 
-int teadfs_send_to_user(char* data, int size) {
+int teadfs_send_to_user(pid_t pid, char* data, int size) {
 	int rc = 0;
 	unsigned char* old_tail;
 	struct sk_buff* skb;
@@ -106,6 +119,12 @@ int teadfs_send_to_user(char* data, int size) {
 
 	LOG_DBG("ENTRY\n");
 	do {
+		//the daemon would get it cut
+		if (size > TEADFS_MSG_MAX_SIZE) {
+			LOG_ERR("message too large:%d\n", size);
+			rc = -EMSGSIZE;
+			break;
+		}
 		//alloc netlink memory
 		skb = nlmsg_new(size, GFP_ATOMIC);
 		if (!skb) {
@@ -114,7 +133,7 @@ int teadfs_send_to_user(char* data, int size) {
 		//copy data
 		nlh = nlmsg_put(skb, 0, 0, 0, size, 0);
 		nlh->nlmsg_len = NLMSG_LENGTH(size);
-		nlh->nlmsg_pid = teadfs_get_client_pid();
+		nlh->nlmsg_pid = pid;
 		nlh->nlmsg_flags = 0;
 
 		NETLINK_CB(skb).portid = 0;
@@ -122,7 +141,7 @@ int teadfs_send_to_user(char* data, int size) {
 		memcpy(nlmsg_data(nlh), data, size);
 		//send
 		read_lock_bh(&user_proc.lock);
-		rc = netlink_unicast(nlfd, skb, teadfs_get_client_pid(), MSG_DONTWAIT);
+		rc = netlink_unicast(nlfd, skb, pid, MSG_DONTWAIT);
 		read_unlock_bh(&user_proc.lock);
 	} while (0);
 	LOG_DBG("LEAVE rc = [%d]\n", rc);
@@ -148,10 +167,10 @@ int teadfs_start_netlink(void)
 	rwlock_init(&user_proc.lock);
 
 	nlfd = netlink_kernel_create(&init_net, NETLINK_TEADFS, &cfg);
-	if (IS_ERR(nlfd))
+	if (!nlfd)
 	{
 		LOG_ERR("can not create a netlink socket\n");
-		return -1;
+		return -ENOMEM;
 	}
 
 	LOG_DBG("LEVAL\n");
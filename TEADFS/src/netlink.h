@@ -1,6 +1,7 @@
 #ifndef __NETLINK_H___
 #define __NETLINK_H___
 
+#include <linux/types.h>
 
 
 
@@ -10,7 +11,8 @@ int teadfs_start_netlink(void);
 // release netlink
 void teadfs_release_netlink(void);
 
-int teadfs_send_to_user(char* data, int size);
+// send to the daemon listening on netlink port pid
+int teadfs_send_to_user(pid_t pid, char* data, int size);
 #endif
 
 
@@ -4,9 +4,11 @@
 #if defined(__KERNEL__)
 	#include <linux/fs.h>
 	#include <linux/types.h>
+	#include <linux/ioctl.h>
 #else
 	#include <iostream>
 	#include <linux/stat.h>
+	#include <linux/ioctl.h>
 	
 	#define kuid_t uid_t
 	#define kgid_t gid_t
@@ -24,11 +26,34 @@
 #define PR_MSG_READ			(PR_MSG_USER + 3)
 #define PR_MSG_WRITE		(PR_MSG_USER + 4)
 #define PR_MSG_CLEANUP		(PR_MSG_USER + 5)
+#define PR_MSG_EVENT		(PR_MSG_USER + 6)
+#define PR_MSG_STAT			(PR_MSG_USER + 7)
 
 
 
 #define ENCRYPT_FILE_HEADER_SIZE 256
 
+//largest netlink payload the daemon receives, a packet and its data
+#define TEADFS_MSG_MAX_SIZE (64 * 1024)
+
+//on-disk formats, format= mount option
+#define TEADFS_FORMAT_V1 1 // label, then a byte stream transformed at any offset
+#define TEADFS_FORMAT_V2 2 // label, then fixed size extents transformed one by one
+#define TEADFS_FORMAT_V3 3 // format 2, full extents inside the file may be stored compressed
+
+//format 2 extent size is 1 << extent_shift, 4K to 32K. an extent and its packet fit in TEADFS_MSG_MAX_SIZE
+#define TEADFS_EXTENT_SHIFT_MIN 12
+#define TEADFS_EXTENT_SHIFT_MAX 15
+#define TEADFS_IV_SEED_SIZE 16
+
+//packet header flags
+#define PR_FLAG_NO_REPLY	0x01	// one-way message, receiver must not answer
+
+//packet header priority, lanes of the upcalls
+#define PR_PRIO_META		0	// open, release, stat and events, an opener waits on it
+#define PR_PRIO_BULK		1	// read and write data transforms
+#define PR_PRIO_COUNT		2
+
 enum OPEN_FILE_RESULT {
 	OFR_INIT = 1,
 	OFR_PROHIBIT,  // prohibit access file
@@ -45,6 +70,16 @@ enum RELEASE_FILE_RESULT {
 	RFR_COUNT
 };
 
+// one-way file events, batched in PR_MSG_EVENT
+enum TEADFS_EVENT_TYPE {
+	TET_UNLINK = 1,
+	TET_RENAME,
+	TET_TRUNCATE,
+	TET_WRITE, // first write after open
+
+	TET_COUNT
+};
+
 struct teadfs_protocol_binary {
 	__u32 size;
 	__u32 offset; //data offset in buffer start
@@ -58,6 +93,10 @@ struct teadfs_packet_header {
 	__u8  msg_type; 
 	//if requester is kernel set 0, if requester is user mode set 1. to support duplex and asynchronous
 	__u8 initiator;
+	//PR_FLAG_*
+	__u8 flags;
+	//PR_PRIO_*, user mode serves PR_PRIO_META first
+	__u8 priority;
 	//current process id
 	pid_t pid;
 	//current process user
@@ -66,30 +105,92 @@ struct teadfs_packet_header {
 	kgid_t gid;
 };
 
+//start of the ENCRYPT_FILE_HEADER_SIZE label, written by user mode. format 1 labels leave it zero after flag
+struct teadfs_file_header {
+	//label flag
+	__u32 flag;
+	//TEADFS_FORMAT_V2, TEADFS_FORMAT_V3, or zero
+	__u8 version;
+	//log2 of the extent size
+	__u8 extent_shift;
+	__u16 reserved;
+	//per file seed, the iv or tweak of extent n is derived from it and n
+	__u8 iv_seed[TEADFS_IV_SEED_SIZE];
+};
+
+//hello_info features
+#define PR_HELLO_OPEN_FD 0x01 // open carries fd_token, taken with TEADFS_IOC_TAKE_FD
+#define PR_HELLO_IDENTITY 0x02 // open and release name the file by teadfs_file_identity and its leaf name
+#define PR_HELLO_RELEASE_FD 0x04 // release carries fd_token, taken with TEADFS_IOC_TAKE_FD
+
+//ioctl on /dev/teadfs. opens the lower file of an fd_token in the calling daemon, returns the fd
+#define TEADFS_IOC_MAGIC 'T'
+#define TEADFS_IOC_TAKE_FD _IOW(TEADFS_IOC_MAGIC, 1, __u64)
+
 struct teadfs_hello_info {
-	//user process pid
+	//user process pid, only logged. the daemon is bound to its netlink port, bind it to the pid
 	pid_t pid;
+	//serve the mounts with this session= option, 0 is the default
+	__u32 session;
+	//PR_HELLO_*
+	__u32 features;
 };
 
+//lower file and the directory it is named in, with PR_HELLO_IDENTITY
+struct teadfs_file_identity {
+	//lower file, dev is new_encode_dev
+	__u32 dev;
+	__u32 generation;
+	__u64 ino;
+	//parent directory, interned while the daemon is bound. 0 when file_path is a full path
+	__u64 dir_id;
+	//lower path of dir_id, sent on first sight and after renames. after file_path
+	struct teadfs_protocol_binary dir_path;
+};
+
+//open reply with PR_HELLO_IDENTITY: dir_id is not known, ask again with dir_path
+#define PR_OPEN_NEED_PATH 0x100
+
+//open_info header_flags
+#define PR_OPEN_HEADER_VALID 0x01 // header holds the start of the lower file
+#define PR_OPEN_HEADER_SHORT 0x02 // lower file is shorter than ENCRYPT_FILE_HEADER_SIZE, header holds all of it
+
 struct teadfs_open_info {
-	//unique open file, likely struct file;
+	//unique open file, never reused. 0 when no file is opened
 	__u64 file_id;
 	// file_path
 	struct teadfs_protocol_binary file_path;
+	//first ENCRYPT_FILE_HEADER_SIZE bytes of the lower file, after file_path
+	struct teadfs_protocol_binary header;
+	//PR_OPEN_HEADER_*. 0 when the kernel could not read it
+	__u32 header_flags;
+	//read-only lower file for TEADFS_IOC_TAKE_FD until the reply, 0 if none
+	__u64 fd_token;
+	//with PR_HELLO_IDENTITY file_path is the leaf name in identity.dir_id
+	struct teadfs_file_identity identity;
 };
 
 struct teadfs_release_info {
-	//unique open file, likely struct file;
+	//file_id of the open
 	__u64 file_id;
 	// file_path
 	struct teadfs_protocol_binary file_path;
+	//read-write lower file for TEADFS_IOC_TAKE_FD, 0 if none
+	__u64 fd_token;
+	//with PR_HELLO_IDENTITY file_path is the leaf name in identity.dir_id
+	struct teadfs_file_identity identity;
 };
 
 
 struct teadfs_read_info {
 	int code; //result code
-	//read file data offset
+	//read file data offset, in the lower file
 	__u64 offset;
+	//format 2 file, zero for format 1. the reply must keep the size
+	__u8 extent_shift;
+	__u8 iv_seed[TEADFS_IV_SEED_SIZE];
+	//format 3 file, data is one whole extent slot, compressed or not
+	__u8 compress;
 	// file data
 	struct teadfs_protocol_binary read_data;
 };
@@ -98,8 +199,13 @@ struct teadfs_read_info {
 
 struct teadfs_write_info {
 	int code; //result code
-	//write file data offset
+	//write file data offset, in the plaintext
 	__u64 offset;
+	//format 2 file, zero for format 1. the reply must keep the size
+	__u8 extent_shift;
+	__u8 iv_seed[TEADFS_IV_SEED_SIZE];
+	//format 3, data is one whole extent the reply may store compressed, in fewer bytes
+	__u8 compress;
 	// file data
 	struct teadfs_protocol_binary write_data;
 };
@@ -109,6 +215,47 @@ struct teadfs_delete_info {
 	struct teadfs_protocol_binary file_path;
 };
 
+struct teadfs_event_record {
+	//record size, include paths and padding. next record start
+	__u32 size;
+	//TEADFS_EVENT_TYPE
+	__u32 event;
+	//inode number
+	__u64 ino;
+	//offset from record start
+	struct teadfs_protocol_binary file_path;
+	//rename target, empty for other events
+	struct teadfs_protocol_binary new_file_path;
+};
+
+struct teadfs_event_info {
+	//count of struct teadfs_event_record
+	__u32 count;
+	struct teadfs_protocol_binary events;
+};
+
+// one file of a PR_MSG_STAT, answered in place
+struct teadfs_stat_record {
+	//record size, include path and padding. next record start
+	__u32 size;
+	//OPEN_FILE_RESULT, set by user mode
+	__s32 access;
+	//inode number
+	__u64 ino;
+	//lower file size, header included
+	__s64 lower_size;
+	//plaintext size set by user mode, -1 to derive it from the header
+	__s64 plain_size;
+	//offset from record start
+	struct teadfs_protocol_binary file_path;
+};
+
+struct teadfs_stat_info {
+	//count of struct teadfs_stat_record
+	__u32 count;
+	struct teadfs_protocol_binary stats;
+};
+
 struct teadfs_cleanup_info {
 	//unique open file, likely struct file;
 	__u64 file_id;
@@ -132,6 +279,8 @@ struct teadfs_packet_info
 		struct teadfs_delete_info del_file;
 		struct teadfs_result_code_info code;
 		struct teadfs_cleanup_info cleanup;
+		struct teadfs_event_info event;
+		struct teadfs_stat_info stat;
 	} data;
 };
 
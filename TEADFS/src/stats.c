@@ -0,0 +1,275 @@
+#include "stats.h"
+#include "teadfs_header.h"
+#include "teadfs_log.h"
+#include "protocol.h"
+#include "mem.h"
+
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
+#include <linux/bitops.h>
+#include <linux/kdev_t.h>
+#include <linux/mutex.h>
+
+//orders stats file open and read against the mount going away
+static DEFINE_MUTEX(teadfs_stats_mutex);
+
+
+static const char* teadfs_stat_names[TS_COUNT] = {
+	[TS_UPCALL_OPEN] = "upcall_open",
+	[TS_UPCALL_READ] = "upcall_read",
+	[TS_UPCALL_WRITE] = "upcall_write",
+	[TS_UPCALL_STAT] = "upcall_stat",
+	[TS_NOTIFY_RELEASE] = "notify_release",
+	[TS_NOTIFY_EVENT] = "notify_event",
+	[TS_BYTES_READ] = "bytes_decrypted",
+	[TS_BYTES_WRITE] = "bytes_encrypted",
+	[TS_BYTES_HOLE] = "bytes_hole",
+	[TS_BYTES_COMPRESS_SAVED] = "bytes_compress_saved",
+	[TS_TIMEOUT] = "timeout",
+	[TS_SEND_DROP] = "send_drop",
+	[TS_NOTIFY_DROP] = "notify_drop",
+	[TS_VERDICT_INIT] = "verdict_init",
+	[TS_VERDICT_PROHIBIT] = "verdict_prohibit",
+	[TS_VERDICT_ENCRYPT] = "verdict_encrypt",
+	[TS_VERDICT_DECRYPT] = "verdict_decrypt",
+	[TS_DECRYPT_TRIM] = "decrypt_trim_pages",
+	[TS_DECRYPT_SHRINK] = "decrypt_shrink_pages",
+	[TS_PREFETCH_HIT] = "prefetch_hit",
+	[TS_LOWER_DROP] = "lower_drop_pages",
+};
+
+static const char* teadfs_latency_names[TL_COUNT] = {
+	[TL_OPEN] = "open",
+	[TL_READ] = "read",
+	[TL_WRITE] = "write",
+	[TL_STAT] = "stat",
+};
+
+static struct teadfs_stats __percpu* teadfs_sb_stats(struct super_block* sb) {
+	if (!sb || !teadfs_get_super_block(sb))
+		return NULL;
+	return teadfs_get_super_block(sb)->stats;
+}
+
+void teadfs_stats_add(struct super_block* sb, enum TEADFS_STAT stat, u64 value) {
+	struct teadfs_stats __percpu* stats = teadfs_sb_stats(sb);
+
+	if (stats)
+		this_cpu_add(stats->count[stat], value);
+}
+
+void teadfs_stats_upcall(struct super_block* sb, __u8 msg_type, u64 start_ns) {
+	struct teadfs_stats __percpu* stats = teadfs_sb_stats(sb);
+	u64 us;
+	int latency;
+	int bucket;
+
+	if (!stats)
+		return;
+	switch (msg_type) {
+	case PR_MSG_OPEN:
+		this_cpu_inc(stats->count[TS_UPCALL_OPEN]);
+		latency = TL_OPEN;
+		break;
+	case PR_MSG_READ:
+		this_cpu_inc(stats->count[TS_UPCALL_READ]);
+		latency = TL_READ;
+		break;
+	case PR_MSG_WRITE:
+		this_cpu_inc(stats->count[TS_UPCALL_WRITE]);
+		latency = TL_WRITE;
+		break;
+	case PR_MSG_STAT:
+		this_cpu_inc(stats->count[TS_UPCALL_STAT]);
+		latency = TL_STAT;
+		break;
+	default:
+		return;
+	}
+	us = div_u64(local_clock() - start_ns, NSEC_PER_USEC);
+	bucket = min(fls64(us), TEADFS_LATENCY_BUCKETS - 1);
+	this_cpu_inc(stats->latency[latency][bucket]);
+}
+
+void teadfs_stats_verdict(struct super_block* sb, int access) {
+	switch (access) {
+	case OFR_PROHIBIT:
+		teadfs_stats_inc(sb, TS_VERDICT_PROHIBIT);
+		break;
+	case OFR_ENCRYPT:
+		teadfs_stats_inc(sb, TS_VERDICT_ENCRYPT);
+		break;
+	case OFR_DECRYPT:
+		teadfs_stats_inc(sb, TS_VERDICT_DECRYPT);
+		break;
+	default:
+		teadfs_stats_inc(sb, TS_VERDICT_INIT);
+		break;
+	}
+}
+
+static void teadfs_stats_file_free(struct kref* ref) {
+	teadfs_free(container_of(ref, struct teadfs_stats_file, ref));
+}
+
+static int teadfs_stats_show(struct seq_file* m, void* v) {
+	struct teadfs_stats_file* stats_file = m->private;
+	struct teadfs_sb_info* sbi;
+	struct teadfs_stats* sum;
+	struct teadfs_stats* cpu_stats;
+	struct teadfs_inode_info* inode_info;
+	unsigned long upper_pages = 0;
+	unsigned long decrypt_pages = 0;
+	//ciphertext cached below files that also have decrypted pages
+	unsigned long double_pages = 0;
+	unsigned long inodes = 0;
+	int cpu, i, j;
+
+	mutex_lock(&teadfs_stats_mutex);
+	//the mount is gone, nothing to show
+	if (!stats_file->sb) {
+		mutex_unlock(&teadfs_stats_mutex);
+		return 0;
+	}
+	sbi = teadfs_get_super_block(stats_file->sb);
+	sum = teadfs_zalloc(sizeof(struct teadfs_stats), GFP_KERNEL);
+	if (!sum) {
+		mutex_unlock(&teadfs_stats_mutex);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		cpu_stats = per_cpu_ptr(sbi->stats, cpu);
+		for (i = 0; i < TS_COUNT; i++)
+			sum->count[i] += cpu_stats->count[i];
+		for (i = 0; i < TL_COUNT; i++)
+			for (j = 0; j < TEADFS_LATENCY_BUCKETS; j++)
+				sum->latency[i][j] += cpu_stats->latency[i][j];
+	}
+	//page cache occupancy
+	spin_lock(&sbi->inode_list_lock);
+	list_for_each_entry(inode_info, &sbi->inode_list, sb_list) {
+		upper_pages += inode_info->vfs_inode.i_data.nrpages;
+		decrypt_pages += inode_info->i_decrypt.nrpages;
+		if (inode_info->i_decrypt.nrpages && inode_info->lower_inode)
+			double_pages += inode_info->lower_inode->i_mapping->nrpages;
+		inodes++;
+	}
+	spin_unlock(&sbi->inode_list_lock);
+
+	for (i = 0; i < TS_COUNT; i++)
+		seq_printf(m, "%s: %llu\n", teadfs_stat_names[i], sum->count[i]);
+	seq_printf(m, "inodes: %lu\n", inodes);
+	seq_printf(m, "upper_pages: %lu\n", upper_pages);
+	seq_printf(m, "decrypt_pages: %lu\n", decrypt_pages);
+	seq_printf(m, "decrypt_lower_pages: %lu\n", double_pages);
+	seq_printf(m, "decrypt_budget: %u\n", sbi->opts.decrypt_budget);
+	for (i = 0; i < TL_COUNT; i++) {
+		seq_printf(m, "latency_%s_us:\n", teadfs_latency_names[i]);
+		for (j = 0; j < TEADFS_LATENCY_BUCKETS; j++) {
+			if (!sum->latency[i][j])
+				continue;
+			seq_printf(m, "  [%llu, %llu): %llu\n", j ? 1ULL << (j - 1) : 0ULL,
+				1ULL << j, sum->latency[i][j]);
+		}
+	}
+	mutex_unlock(&teadfs_stats_mutex);
+	teadfs_free(sum);
+	return 0;
+}
+
+static int teadfs_stats_open(struct inode* inode, struct file* file) {
+	struct teadfs_stats_file* stats_file;
+	int rc;
+
+	mutex_lock(&teadfs_stats_mutex);
+	stats_file = inode->i_private;
+	if (stats_file)
+		kref_get(&stats_file->ref);
+	mutex_unlock(&teadfs_stats_mutex);
+	if (!stats_file)
+		return -ENOENT;
+	rc = single_open(file, teadfs_stats_show, stats_file);
+	if (rc)
+		kref_put(&stats_file->ref, teadfs_stats_file_free);
+	return rc;
+}
+
+static int teadfs_stats_release(struct inode* inode, struct file* file) {
+	struct teadfs_stats_file* stats_file = ((struct seq_file*)file->private_data)->private;
+
+	single_release(inode, file);
+	kref_put(&stats_file->ref, teadfs_stats_file_free);
+	return 0;
+}
+
+static const struct file_operations teadfs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = teadfs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = teadfs_stats_release,
+};
+
+int teadfs_stats_create(struct super_block* sb) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(sb);
+	struct dentry* root = teadfs_debugfs_root();
+	char name[32];
+	int rc = 0;
+
+	LOG_DBG("ENTRY\n");
+	do {
+		sbi->stats = alloc_percpu(struct teadfs_stats);
+		if (!sbi->stats) {
+			rc = -ENOMEM;
+			break;
+		}
+		//statistics are optional, the mount goes on without debugfs
+		if (IS_ERR_OR_NULL(root))
+			break;
+		snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+		sbi->debugfs_dir = debugfs_create_dir(name, root);
+		if (IS_ERR_OR_NULL(sbi->debugfs_dir)) {
+			sbi->debugfs_dir = NULL;
+			break;
+		}
+		sbi->stats_file = teadfs_zalloc(sizeof(struct teadfs_stats_file), GFP_KERNEL);
+		if (!sbi->stats_file)
+			break;
+		kref_init(&sbi->stats_file->ref);
+		sbi->stats_file->sb = sb;
+		sbi->stats_file->dentry = debugfs_create_file("stats", 0400, sbi->debugfs_dir,
+			sbi->stats_file, &teadfs_stats_fops);
+		if (IS_ERR_OR_NULL(sbi->stats_file->dentry)) {
+			teadfs_free(sbi->stats_file);
+			sbi->stats_file = NULL;
+		}
+	} while (0);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+void teadfs_stats_destroy(struct super_block* sb) {
+	struct teadfs_sb_info* sbi = teadfs_get_super_block(sb);
+
+	if (!sbi)
+		return;
+	//files already open read nothing from now on, new opens fail
+	if (sbi->stats_file) {
+		mutex_lock(&teadfs_stats_mutex);
+		sbi->stats_file->dentry->d_inode->i_private = NULL;
+		sbi->stats_file->sb = NULL;
+		mutex_unlock(&teadfs_stats_mutex);
+	}
+	debugfs_remove_recursive(sbi->debugfs_dir);
+	sbi->debugfs_dir = NULL;
+	if (sbi->stats_file) {
+		kref_put(&sbi->stats_file->ref, teadfs_stats_file_free);
+		sbi->stats_file = NULL;
+	}
+	if (sbi->stats) {
+		free_percpu(sbi->stats);
+		sbi->stats = NULL;
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef __STATS_H___
+#define __STATS_H___
+
+#include <linux/fs.h>
+#include <linux/types.h>
+#include <linux/kref.h>
+
+enum TEADFS_STAT {
+	//upcalls waiting for a reply
+	TS_UPCALL_OPEN,
+	TS_UPCALL_READ,
+	TS_UPCALL_WRITE,
+	TS_UPCALL_STAT,
+	//one-way notifies sent
+	TS_NOTIFY_RELEASE,
+	TS_NOTIFY_EVENT,
+	//bytes decrypted by read upcalls, encrypted by write upcalls
+	TS_BYTES_READ,
+	TS_BYTES_WRITE,
+	//bytes of lower holes read as zeros without an upcall
+	TS_BYTES_HOLE,
+	//lower bytes saved by compressed format 3 extents
+	TS_BYTES_COMPRESS_SAVED,
+	//upcall got no reply in time
+	TS_TIMEOUT,
+	//transport refused the message
+	TS_SEND_DROP,
+	//event queue full
+	TS_NOTIFY_DROP,
+	//open verdicts, OPEN_FILE_RESULT
+	TS_VERDICT_INIT,
+	TS_VERDICT_PROHIBIT,
+	TS_VERDICT_ENCRYPT,
+	TS_VERDICT_DECRYPT,
+	//i_decrypt pages dropped over the decrypt_budget, and by the shrinker
+	TS_DECRYPT_TRIM,
+	TS_DECRYPT_SHRINK,
+	//getattr answered by a readdirplus prefetch
+	TS_PREFETCH_HIT,
+	//lower ciphertext pages dropped by lower_nocache
+	TS_LOWER_DROP,
+
+	TS_COUNT,
+};
+
+enum TEADFS_LATENCY {
+	TL_OPEN,
+	TL_READ,
+	TL_WRITE,
+	TL_STAT,
+
+	TL_COUNT,
+};
+
+//bucket n counts round trips of [2^(n-1), 2^n) microseconds
+#define TEADFS_LATENCY_BUCKETS 32
+
+struct teadfs_stats {
+	u64 count[TS_COUNT];
+	u64 latency[TL_COUNT][TEADFS_LATENCY_BUCKETS];
+};
+
+//an open stats file holds a reference, sb is cleared when the mount goes away
+struct teadfs_stats_file {
+	struct kref ref;
+	struct super_block* sb;
+	struct dentry* dentry;
+};
+
+//alloc counters and create <debugfs>/teadfs/<major:minor>/stats
+int teadfs_stats_create(struct super_block* sb);
+
+//remove debugfs entry and free counters
+void teadfs_stats_destroy(struct super_block* sb);
+
+//sb may be NULL, then nothing is counted
+void teadfs_stats_add(struct super_block* sb, enum TEADFS_STAT stat, u64 value);
+
+//count an answered upcall and its round trip since start_ns, local_clock based
+void teadfs_stats_upcall(struct super_block* sb, __u8 msg_type, u64 start_ns);
+
+//count an open verdict
+void teadfs_stats_verdict(struct super_block* sb, int access);
+
+#define teadfs_stats_inc(sb, stat) teadfs_stats_add(sb, stat, 1)
+
+#endif
@@ -27,6 +27,8 @@
 #include "teadfs_log.h"
 #include "teadfs_header.h"
 #include "mem.h"
+#include "user_com.h"
+#include "cache.h"
 
 #include <linux/fs.h>
 #include <linux/mount.h>
@@ -87,10 +89,17 @@ static struct inode *teadfs_alloc_inode(struct super_block *sb)
 		//init
 		inode_init_once(&(inode_info->vfs_inode));
 		mutex_init(&inode_info->lower_file_mutex);
+		mutex_init(&inode_info->extent_mutex);
 		atomic_set(&inode_info->lower_file_count, 0);
 		inode_info->file_decrypt = 0;
+		spin_lock_init(&inode_info->open_flight_lock);
+		INIT_LIST_HEAD(&inode_info->open_flights);
+		INIT_LIST_HEAD(&inode_info->faulting);
 		address_space_init_once(&(inode_info->i_decrypt));
 		inode = &inode_info->vfs_inode;
+		spin_lock(&teadfs_get_super_block(sb)->inode_list_lock);
+		list_add_tail(&inode_info->sb_list, &teadfs_get_super_block(sb)->inode_list);
+		spin_unlock(&teadfs_get_super_block(sb)->inode_list_lock);
 	} while (0);
 
 	LOG_DBG("LEVAL\n");
@@ -122,6 +131,9 @@ static void teadfs_destroy_inode(struct inode *inode)
 	LOG_DBG("ENTRY\n");
 	inode_info = teadfs_inode_to_private(inode);
 	//BUG_ON(!inode_info->lower_inode);
+	spin_lock(&teadfs_get_super_block(inode->i_sb)->inode_list_lock);
+	list_del(&inode_info->sb_list);
+	spin_unlock(&teadfs_get_super_block(inode->i_sb)->inode_list_lock);
 
 	call_rcu(&inode->i_rcu, teadfs_i_callback);
 	LOG_DBG("LEVAL\n");
@@ -172,9 +184,25 @@ static int teadfs_statfs(struct dentry *dentry, struct kstatfs *buf)
  */
 static void teadfs_evict_inode(struct inode *inode)
 {
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+
 	LOG_DBG("ENTRY\n");
+	//pages dirtied through shared mmap
+	if (inode->i_nlink) {
+		filemap_write_and_wait(&inode_info->i_decrypt);
+		filemap_write_and_wait(&inode->i_data);
+	}
+	teadfs_decrypt_cache_dropped(inode->i_sb, inode_info->i_decrypt.nrpages);
+	truncate_inode_pages(&inode_info->i_decrypt, 0);
 	truncate_inode_pages(&inode->i_data, 0);
 	clear_inode(inode);
+	teadfs_drop_open_verdicts(inode);
+	put_pid(inode_info->attr_pid);
+	inode_info->attr_pid = NULL;
+	if (inode_info->mmap_lower_file) {
+		fput(inode_info->mmap_lower_file);
+		inode_info->mmap_lower_file = NULL;
+	}
 	iput(teadfs_inode_to_lower(inode));
 	LOG_DBG("LEVAL\n");
 }
@@ -187,8 +215,24 @@ static void teadfs_evict_inode(struct inode *inode)
  */
 static int teadfs_show_options(struct seq_file *m, struct dentry *root)
 {
-	seq_printf(m, "teadfs");
-
+	struct teadfs_mount_opts* opts = &teadfs_get_super_block(root->d_sb)->opts;
+
+	seq_printf(m, ",ra_pages=%u", opts->ra_pages);
+	seq_printf(m, ",max_inflight=%u", opts->max_inflight);
+	seq_printf(m, ",upcall_timeout=%u", opts->upcall_timeout);
+	seq_printf(m, ",verdict_ttl=%u", opts->verdict_ttl);
+	seq_printf(m, ",verdict_cache=%u", opts->verdict_cache);
+	if (opts->passthrough)
+		seq_puts(m, ",passthrough");
+	seq_printf(m, ",format=%u", opts->format);
+	seq_puts(m, ",transport=netlink");
+	seq_printf(m, ",session=%u", opts->session);
+	if (opts->decrypt_budget)
+		seq_printf(m, ",decrypt_budget=%u", opts->decrypt_budget);
+	if (opts->readdirplus)
+		seq_printf(m, ",readdirplus=%u", opts->readdirplus);
+	if (opts->lower_nocache)
+		seq_puts(m, ",lower_nocache");
 	return 0;
 }
 
@@ -7,36 +7,130 @@
 #include <linux/fs.h>
 #include <linux/path.h>
 #include <linux/wait.h>
+#include <linux/completion.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/shrinker.h>
+#include <linux/workqueue.h>
 #if defined(CONFIG_BDICONFIG_BDI)
 	#include <linux/backing-dev.h>
 #endif
 #include "teadfs_log.h"
+#include "stats.h"
+#include "global_param.h"
 
 #define TEADFS_SUPER_MAGIC 0x44414554
 
+enum TEADFS_TRANSPORT {
+	TTP_NETLINK = 1,
+};
+
+/* mount options, filled by teadfs_parse_options */
+struct teadfs_mount_opts {
+	//readahead window of the upper mapping, in pages
+	unsigned int ra_pages;
+	//upcalls waiting for user mode at once, 0 is unlimited
+	unsigned int max_inflight;
+	//seconds to wait for user mode
+	unsigned int upcall_timeout;
+	//milliseconds an open verdict is reused, 0 disables the cache
+	unsigned int verdict_ttl;
+	//cached verdicts per inode
+	unsigned int verdict_cache;
+	//plain files read and write the lower file, no upper page cache
+	int passthrough;
+	//highest on-disk format version read, TEADFS_FORMAT_V*
+	unsigned int format;
+	//TEADFS_TRANSPORT
+	int transport;
+	//daemon session serving this mount, see PR_MSG_HELLO
+	__u32 session;
+	//pages of decrypted data cached by the mount, 0 is unlimited
+	unsigned int decrypt_budget;
+	//milliseconds readdir prefetched attributes are used, 0 disables readdirplus
+	unsigned int readdirplus;
+	//ciphertext read and written for encrypted files is not kept in the lower page cache
+	int lower_nocache;
+};
+
+/* upcalls in flight of a mount, when opts.max_inflight is set. */
+struct teadfs_upcall_window {
+	spinlock_t lock;
+	unsigned int inflight;
+	//PR_PRIO_BULK upcalls in flight, the rest of the window is kept for PR_PRIO_META
+	unsigned int bulk_inflight;
+	//struct teadfs_upcall_waiter per lane, oldest first
+	struct list_head waiters[PR_PRIO_COUNT];
+	//process granted the last bulk slot, waiters of other processes go first
+	pid_t last_bulk_tgid;
+};
+
 /* wrapfs super-block data in memory */
 struct teadfs_sb_info {
+	struct super_block* sb;
 	struct super_block* lower_sb;
+	struct teadfs_mount_opts opts;
+	//limits upcalls in flight when opts.max_inflight is set
+	struct teadfs_upcall_window upcall_window;
+	//bound daemon and its in-flight upcalls
+	struct teadfs_session* session;
 
 #if defined(CONFIG_BDICONFIG_BDI)
 	struct backing_dev_info bdi;
 #endif
+	//percpu counters, see stats.h
+	struct teadfs_stats __percpu* stats;
+	struct dentry* debugfs_dir;
+	//what the stats file reads through, outlives the mount while it is open
+	struct teadfs_stats_file* stats_file;
+	//teadfs inodes of this mount, for page cache occupancy
+	spinlock_t inode_list_lock;
+	struct list_head inode_list;
+	//i_decrypt trimming, see cache.h
+	struct shrinker decrypt_shrinker;
+	struct work_struct decrypt_trim_work;
+	atomic_t decrypt_added;
+	//running count of i_decrypt pages for the shrinker, resynced by the trim work
+	atomic_long_t decrypt_pages;
+	int decrypt_cache_ready;
 };
 
 
 /* wrapfs dentry data in memory */
 struct teadfs_dentry_info {
-	spinlock_t lock; /* protects lower_path */
+	spinlock_t lock; /* serializes lower_path writers */
+	seqcount_t seq; /* lower_path readers, lockless */
 	struct path lower_path;
+	/* freed after rcu-walk readers are gone */
+	struct rcu_head rcu;
 };
 
 /* file private data. */
 struct teadfs_file_info {
 	struct file* lower_file;
+	//names the open to user mode, a freed file's address may come back before its release is sent
+	__u64 file_id;
 	enum OPEN_FILE_RESULT access;
 	char* file_path;
 	int file_path_length;
 	char* file_path_buf;
+	//write event sent since open
+	int written;
+};
+
+
+/* open verdict request in flight, shared by concurrent getattr and truncate of one inode. */
+struct teadfs_open_flight {
+	struct list_head list;
+	//executable of the opener, referenced while the flight lives. only compared by address
+	struct file* exe_id;
+	//OPEN_FILE_RESULT or error code of the upcall
+	int result;
+	atomic_t count;
+	struct completion done;
+	//verdict kept after the upcall, until expires
+	int cached;
+	unsigned long expires;
 };
 
 
@@ -49,6 +143,38 @@ struct teadfs_inode_info {
 	struct address_space i_decrypt;
 	atomic_t lower_file_count;
 	int file_decrypt;
+	//lower file kept for writeback of shared writable mmap while one is mapped,
+	//protected by lower_file_mutex with the count of those vmas
+	struct file* mmap_lower_file;
+	int mmap_count;
+	//entry in teadfs_sb_info inode_list, least recently used i_decrypt first
+	struct list_head sb_list;
+	//jiffies of the last move to the tail of inode_list
+	unsigned long decrypt_touched;
+	//tasks in teadfs_vm_fault, protected by i_lock
+	struct list_head faulting;
+	//open verdict requests in flight, protected by open_flight_lock
+	spinlock_t open_flight_lock;
+	struct list_head open_flights;
+	//cached verdicts in open_flights
+	unsigned int open_verdicts;
+	//readdirplus answer, used by getattr while the lower size is attr_lower_size. i_lock
+	//the verdict depends on the caller, so only the listing process, attr_pid, uses it
+	struct pid* attr_pid;
+	int attr_access;
+	loff_t attr_plain_size;
+	loff_t attr_lower_size;
+	unsigned long attr_expires;
+	//format 2 file, read from the label at open. zero for format 1
+	__u8 extent_shift;
+	__u8 iv_seed[TEADFS_IV_SEED_SIZE];
+	//format 3 file, extents may be stored compressed
+	__u8 extent_compress;
+	//serializes the read-modify-write of extents by write and writeback
+	struct mutex extent_mutex;
+	//directory, interned id sent to a PR_HELLO_IDENTITY daemon and the name epoch it got the path at. i_lock
+	__u64 dir_id;
+	unsigned int dir_epoch;
 };
 
 
@@ -59,6 +185,9 @@ struct teadfs_msg_ctx {
 #define TEADFS_MSG_CTX_STATE_NO_REPLY 0x04
 	u8 state;
 	__u64 msg_id;
+	//for tracing
+	__u8 msg_type;
+	unsigned long ino;
 	size_t request_msg_size;
 	char* request_msg;
 	size_t response_msg_size;
@@ -73,6 +202,12 @@ struct teadfs_msg_ctx {
 static struct teadfs_sb_info* teadfs_get_super_block(struct super_block *super) {
 	return ((struct teadfs_sb_info*)(super)->s_fs_info);
 };
+/* daemon session of the mount, default session without a mount */
+static inline struct teadfs_session* teadfs_sb_session(struct super_block* sb) {
+	if (sb && teadfs_get_super_block(sb) && teadfs_get_super_block(sb)->session)
+		return teadfs_get_super_block(sb)->session;
+	return teadfs_default_session();
+}
 static void
 teadfs_set_superblock_lower(struct super_block* sb,
 	struct super_block* lower_sb)
@@ -128,45 +263,47 @@ static inline void pathcpy(struct path* dst, const struct path* src) {
 	dst->dentry = src->dentry;
 	dst->mnt = src->mnt;
 }
-/* Returns struct path.  Caller must path_put it. */
-static inline void teadfs_get_lower_path(const struct dentry* dent, struct path* lower_path) {
-	struct teadfs_dentry_info* lower_dentry = teadfs_dentry_to_private(dent);
-	spin_lock(&(lower_dentry->lock));
-	LOG_DBG("ENTRY %d\n", lower_dentry->lower_path.dentry->d_lockref.count);
-	pathcpy(lower_path, &(lower_dentry->lower_path));
-	//path_get(lower_path);
-	spin_unlock(&(lower_dentry->lock));
-	LOG_DBG("LEAVE\n");
+static inline void teadfs_init_dentry_private(struct teadfs_dentry_info* dentry_info) {
+	spin_lock_init(&(dentry_info->lock));
+	seqcount_init(&(dentry_info->seq));
+}
+/* Lower path of private data the caller already loaded, see teadfs_get_lower_path. */
+static inline void teadfs_info_lower_path(struct teadfs_dentry_info* dentry_info, struct path* lower_path) {
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&(dentry_info->seq));
+		pathcpy(lower_path, &(dentry_info->lower_path));
+	} while (read_seqcount_retry(&(dentry_info->seq), seq));
 	return;
 }
+/* Returns struct path. No reference is taken, lockless and safe in rcu-walk. */
+static inline void teadfs_get_lower_path(const struct dentry* dent, struct path* lower_path) {
+	teadfs_info_lower_path(teadfs_dentry_to_private((struct dentry*)dent), lower_path);
+}
 static inline void teadfs_put_lower_path(const struct dentry* dent, struct path* lower_path) {
-	struct teadfs_dentry_info* lower_dentry = teadfs_dentry_to_private(dent);
-	spin_lock(&(lower_dentry->lock));
-	LOG_DBG("ENTRY %d\n", lower_dentry->lower_path.dentry->d_lockref.count);
-	//path_put(lower_path);
-	spin_unlock(&(lower_dentry->lock));
-	LOG_DBG("LEAVE\n");
 	return;
 }
 static inline void teadfs_set_lower_path(const struct dentry* dent, struct path* lower_path) {
-	struct teadfs_dentry_info* lower_dentry = teadfs_dentry_to_private(dent);
-	LOG_DBG("ENTRY\n");
-	spin_lock(&(lower_dentry->lock));
-	pathcpy(&(((struct teadfs_dentry_info*)(dent)->d_fsdata)->lower_path), lower_path);
-	spin_unlock(&(lower_dentry->lock));
-	LOG_DBG("LEAVE %d\n", lower_dentry->lower_path.dentry->d_lockref.count);
+	struct teadfs_dentry_info* dentry_info = teadfs_dentry_to_private((struct dentry*)dent);
+	spin_lock(&(dentry_info->lock));
+	write_seqcount_begin(&(dentry_info->seq));
+	pathcpy(&(dentry_info->lower_path), lower_path);
+	write_seqcount_end(&(dentry_info->seq));
+	spin_unlock(&(dentry_info->lock));
 	return;
 }
 static inline void wrapfs_put_reset_lower_path(const struct dentry* dent) {
+	struct teadfs_dentry_info* dentry_info = teadfs_dentry_to_private((struct dentry*)dent);
 	struct path lower_path;
-	LOG_DBG("ENTRY %d\n", dent->d_lockref.count);
-	spin_lock(&(((struct teadfs_dentry_info*)(dent)->d_fsdata)->lock));
-	pathcpy(&lower_path, &(((struct teadfs_dentry_info*)(dent)->d_fsdata)->lower_path));
-	((struct teadfs_dentry_info*)(dent)->d_fsdata)->lower_path.dentry = NULL;
-	((struct teadfs_dentry_info*)(dent)->d_fsdata)->lower_path.mnt = NULL;
-	spin_unlock(&(((struct teadfs_dentry_info*)(dent)->d_fsdata)->lock));
+	spin_lock(&(dentry_info->lock));
+	write_seqcount_begin(&(dentry_info->seq));
+	pathcpy(&lower_path, &(dentry_info->lower_path));
+	dentry_info->lower_path.dentry = NULL;
+	dentry_info->lower_path.mnt = NULL;
+	write_seqcount_end(&(dentry_info->seq));
+	spin_unlock(&(dentry_info->lock));
 	path_put(&lower_path);
-	LOG_DBG("ENTRY\n");
 	return;
 }
 
@@ -1,65 +1,215 @@
 #include "teadfs_log.h"
 
 #include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/printk.h>
-#include <linux/fs.h>
-#include <linux/file.h>
-#include <linux/poll.h>
-#include <linux/slab.h>
-#include <linux/mount.h>
-#include <linux/pagemap.h>
-#include <linux/security.h>
-#include <linux/compat.h>
-#include <linux/fs_stack.h>
-#include <linux/aio.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
 
 
-#define LOG_MAX_BUF 4096
+/* records kept per cpu, must be a power of two */
+#define TEADFS_LOG_RECORDS 256
+#define TEADFS_LOG_RECORD_SIZE 256
 
-void teadfs_write_log(const char* fmt, va_list ap);
+struct teadfs_log_record {
+	//0 while the record is being written
+	unsigned long seq;
+	u64 ts;
+	int level;
+	char text[TEADFS_LOG_RECORD_SIZE - sizeof(unsigned long) - sizeof(u64) - sizeof(int)];
+};
 
+struct teadfs_log_ring {
+	unsigned long head;
+	struct teadfs_log_record records[TEADFS_LOG_RECORDS];
+};
+
+struct static_key teadfs_log_key[TLL_CNT] = {
+	[0 ... TLL_CNT - 1] = STATIC_KEY_INIT_FALSE,
+};
+
+static DEFINE_PER_CPU(struct teadfs_log_ring*, teadfs_log_ring);
+static struct dentry* g_log_dir;
+static DEFINE_MUTEX(g_log_level_mutex);
+//keys of a module can only be switched once it is running
+static int g_log_ready;
+static int g_log_level = TLL_INF;
+
+static void teadfs_log_apply_level(int level) {
+	int i;
+	int enable;
+
+	for (i = TLL_DBG; i < TLL_CNT; i++) {
+		enable = (g_log_ready && i >= level);
+		if (enable && !static_key_enabled(&teadfs_log_key[i])) {
+			static_key_slow_inc(&teadfs_log_key[i]);
+		} else if (!enable && static_key_enabled(&teadfs_log_key[i])) {
+			static_key_slow_dec(&teadfs_log_key[i]);
+		}
+	}
+}
+
+static int teadfs_log_level_set(const char* val, const struct kernel_param* kp) {
+	int level;
+	int rc;
+
+	rc = kstrtoint(val, 0, &level);
+	if (rc)
+		return rc;
+	if (level < TLL_DBG || level > TLL_CNT)
+		return -EINVAL;
+	mutex_lock(&g_log_level_mutex);
+	g_log_level = level;
+	teadfs_log_apply_level(level);
+	mutex_unlock(&g_log_level_mutex);
+	return 0;
+}
+
+static struct kernel_param_ops teadfs_log_level_ops = {
+	.set = teadfs_log_level_set,
+	.get = param_get_int,
+};
+module_param_cb(log_level, &teadfs_log_level_ops, &g_log_level, 0644);
+MODULE_PARM_DESC(log_level, "lowest level logged: 0 debug, 1 info, 2 error, 3 off");
+
+/**
+ * teadfs_log
+ *
+ * Format into the next record of this cpu's ring. Only interrupts are
+ * disabled, writers never wait on each other or on a reader.
+ */
 void teadfs_log(enum TEADFS_LOG_LEVEL level, const char* format, ...) {
+	struct teadfs_log_ring* ring;
+	struct teadfs_log_record* record;
+	unsigned long flags;
+	unsigned long seq;
 	va_list args;
-	va_start(args, format); // 这里是最后一个固定参数
-	switch (level)
-	{
-	case TLL_DBG:
-		//vprintk(format, args);
-		break;
-	case TLL_INF:
-		//vprintk(format, args);
-		teadfs_write_log(format, args);
-		break;
-	case TLL_ERR:
-		//vprintk(format, args);
-		teadfs_write_log(format, args);
-		break;
-	case TLL_CNT:
-		vprintk(format, args);
-		teadfs_write_log(format, args);
-		break;
-	default:
-		break;
+
+	local_irq_save(flags);
+	ring = __this_cpu_read(teadfs_log_ring);
+	if (ring) {
+		seq = ++ring->head;
+		record = &ring->records[seq & (TEADFS_LOG_RECORDS - 1)];
+		record->seq = 0;
+		smp_wmb();
+		record->ts = local_clock();
+		record->level = level;
+		va_start(args, format);
+		vsnprintf(record->text, sizeof(record->text), format, args);
+		va_end(args);
+		smp_wmb();
+		record->seq = seq;
 	}
-	return;
+	local_irq_restore(flags);
 }
 
+/* seq_file position is cpu * TEADFS_LOG_RECORDS + age, oldest first */
+static void* teadfs_log_seq_start(struct seq_file* m, loff_t* pos) {
+	if (*pos >= (loff_t)nr_cpu_ids * TEADFS_LOG_RECORDS)
+		return NULL;
+	return pos;
+}
 
-static struct file* g_file;
+static void* teadfs_log_seq_next(struct seq_file* m, void* v, loff_t* pos) {
+	(*pos)++;
+	return teadfs_log_seq_start(m, pos);
+}
 
-int teadfs_log_create(void) {
-	int flags_new = O_CREAT | O_RDWR | O_APPEND | O_LARGEFILE;
+static void teadfs_log_seq_stop(struct seq_file* m, void* v) {
+}
 
-	g_file = filp_open("/ttt.log", flags_new, 0666);
+static int teadfs_log_seq_show(struct seq_file* m, void* v) {
+	loff_t pos = *(loff_t*)v;
+	int cpu = pos / TEADFS_LOG_RECORDS;
+	struct teadfs_log_ring* ring;
+	struct teadfs_log_record* record;
+	struct teadfs_log_record copy;
+	unsigned long seq;
 
+	if (!cpu_possible(cpu))
+		return 0;
+	ring = per_cpu(teadfs_log_ring, cpu);
+	if (!ring)
+		return 0;
+	seq = ACCESS_ONCE(ring->head) + 1 + (pos % TEADFS_LOG_RECORDS);
+	record = &ring->records[seq & (TEADFS_LOG_RECORDS - 1)];
+	copy.seq = ACCESS_ONCE(record->seq);
+	smp_rmb();
+	memcpy(&copy, record, sizeof(copy));
+	smp_rmb();
+	//empty, or rewritten while copying
+	if (!copy.seq || copy.seq != ACCESS_ONCE(record->seq))
+		return 0;
+	copy.text[sizeof(copy.text) - 1] = '\0';
+	seq_printf(m, "[%5llu.%06llu] [%d] %s", copy.ts / NSEC_PER_SEC,
+		(copy.ts % NSEC_PER_SEC) / NSEC_PER_USEC, cpu, copy.text);
+	return 0;
 }
-int teadfs_log_release(void) {
-	filp_close(g_file, NULL);
 
+static const struct seq_operations teadfs_log_seq_ops = {
+	.start = teadfs_log_seq_start,
+	.next = teadfs_log_seq_next,
+	.stop = teadfs_log_seq_stop,
+	.show = teadfs_log_seq_show,
+};
+
+static int teadfs_log_open(struct inode* inode, struct file* file) {
+	return seq_open(file, &teadfs_log_seq_ops);
+}
+
+static const struct file_operations teadfs_log_fops = {
+	.owner = THIS_MODULE,
+	.open = teadfs_log_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+struct dentry* teadfs_debugfs_root(void) {
+	return g_log_dir;
 }
 
-void teadfs_write_log(const char* fmt, va_list ap) {
-	char buf[LOG_MAX_BUF] = { 0 };
-	vsnprintf(buf, LOG_MAX_BUF, fmt, ap);
-	kernel_write(g_file, buf, strlen(buf), g_file->f_pos);
+int teadfs_log_create(void) {
+	int cpu;
+	struct teadfs_log_ring* ring;
+
+	for_each_possible_cpu(cpu) {
+		ring = vzalloc(sizeof(struct teadfs_log_ring));
+		if (!ring)
+			continue;
+		per_cpu(teadfs_log_ring, cpu) = ring;
+	}
+	g_log_dir = debugfs_create_dir("teadfs", NULL);
+	if (!IS_ERR_OR_NULL(g_log_dir)) {
+		debugfs_create_file("log", 0400, g_log_dir, NULL, &teadfs_log_fops);
+	}
+	mutex_lock(&g_log_level_mutex);
+	g_log_ready = 1;
+	teadfs_log_apply_level(g_log_level);
+	mutex_unlock(&g_log_level_mutex);
+	return 0;
+}
+
+int teadfs_log_release(void) {
+	int cpu;
+	struct teadfs_log_ring* ring;
+
+	mutex_lock(&g_log_level_mutex);
+	g_log_ready = 0;
+	teadfs_log_apply_level(g_log_level);
+	mutex_unlock(&g_log_level_mutex);
+	debugfs_remove_recursive(g_log_dir);
+	g_log_dir = NULL;
+	for_each_possible_cpu(cpu) {
+		ring = per_cpu(teadfs_log_ring, cpu);
+		per_cpu(teadfs_log_ring, cpu) = NULL;
+		if (ring)
+			vfree(ring);
+	}
+	return 0;
 }
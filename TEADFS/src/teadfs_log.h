@@ -2,6 +2,7 @@
 #define TEADFS_LOG_H
 
 #include <linux/kernel.h>
+#include <linux/jump_label.h>
 
 enum TEADFS_LOG_LEVEL {
 	TLL_DBG,
@@ -11,13 +12,24 @@ enum TEADFS_LOG_LEVEL {
 	TLL_CNT,
 };
 
+//one key per level, disabled levels cost a single patched branch
+extern struct static_key teadfs_log_key[TLL_CNT];
+
 void teadfs_log(enum TEADFS_LOG_LEVEL level, const char* format, ...);
 
 int teadfs_log_create(void);
 int teadfs_log_release(void);
 
-#define LOG_DBG(FMT, ...) teadfs_log(TLL_DBG, "%s(%d)[debug] " FMT, __FUNCTION__, __LINE__, ##__VA_ARGS__); 
-#define LOG_INF(FMT, ...) teadfs_log(TLL_INF, "%s(%d)[info ] " FMT, __FUNCTION__, __LINE__, ##__VA_ARGS__); 
-#define LOG_ERR(FMT, ...) teadfs_log(TLL_ERR, "%s(%d)[error] " FMT, __FUNCTION__, __LINE__, ##__VA_ARGS__); 
+//<debugfs>/teadfs, NULL or error if debugfs is missing
+struct dentry* teadfs_debugfs_root(void);
+
+#define TEADFS_LOG(LEVEL, FMT, ...) do { \
+		if (static_key_false(&teadfs_log_key[LEVEL])) \
+			teadfs_log(LEVEL, FMT, ##__VA_ARGS__); \
+	} while (0)
+
+#define LOG_DBG(FMT, ...) TEADFS_LOG(TLL_DBG, "%s(%d)[debug] " FMT, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define LOG_INF(FMT, ...) TEADFS_LOG(TLL_INF, "%s(%d)[info ] " FMT, __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define LOG_ERR(FMT, ...) TEADFS_LOG(TLL_ERR, "%s(%d)[error] " FMT, __FUNCTION__, __LINE__, ##__VA_ARGS__)
 
 #endif // !TEADFS_LOG_H
@@ -0,0 +1,118 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM teadfs
+
+#if !defined(TEADFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define TEADFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+
+/* one upcall, keyed by msg_id from enqueue to wakeup or timeout */
+DECLARE_EVENT_CLASS(teadfs_upcall_class,
+	TP_PROTO(__u64 msg_id, __u8 msg_type, size_t size, unsigned long ino),
+	TP_ARGS(msg_id, msg_type, size, ino),
+	TP_STRUCT__entry(
+		__field(__u64, msg_id)
+		__field(__u8, msg_type)
+		__field(size_t, size)
+		__field(unsigned long, ino)
+	),
+	TP_fast_assign(
+		__entry->msg_id = msg_id;
+		__entry->msg_type = msg_type;
+		__entry->size = size;
+		__entry->ino = ino;
+	),
+	TP_printk("msg_id=0x%llx msg_type=%u size=%zu ino=%lu",
+		__entry->msg_id, __entry->msg_type, __entry->size, __entry->ino)
+);
+
+//request queued for a reply
+DEFINE_EVENT(teadfs_upcall_class, teadfs_upcall_enqueue,
+	TP_PROTO(__u64 msg_id, __u8 msg_type, size_t size, unsigned long ino),
+	TP_ARGS(msg_id, msg_type, size, ino));
+
+//request handed to the transport
+DEFINE_EVENT(teadfs_upcall_class, teadfs_upcall_send,
+	TP_PROTO(__u64 msg_id, __u8 msg_type, size_t size, unsigned long ino),
+	TP_ARGS(msg_id, msg_type, size, ino));
+
+//reply matched to its waiter, size is the reply size
+DEFINE_EVENT(teadfs_upcall_class, teadfs_upcall_reply,
+	TP_PROTO(__u64 msg_id, __u8 msg_type, size_t size, unsigned long ino),
+	TP_ARGS(msg_id, msg_type, size, ino));
+
+//waiter running again with the reply
+DEFINE_EVENT(teadfs_upcall_class, teadfs_upcall_wakeup,
+	TP_PROTO(__u64 msg_id, __u8 msg_type, size_t size, unsigned long ino),
+	TP_ARGS(msg_id, msg_type, size, ino));
+
+//waiter gave up without a reply
+DEFINE_EVENT(teadfs_upcall_class, teadfs_upcall_timeout,
+	TP_PROTO(__u64 msg_id, __u8 msg_type, size_t size, unsigned long ino),
+	TP_ARGS(msg_id, msg_type, size, ino));
+
+TRACE_EVENT(teadfs_readpage,
+	TP_PROTO(struct inode* inode, pgoff_t index, int rc),
+	TP_ARGS(inode, index, rc),
+	TP_STRUCT__entry(
+		__field(unsigned long, ino)
+		__field(pgoff_t, index)
+		__field(int, rc)
+	),
+	TP_fast_assign(
+		__entry->ino = inode->i_ino;
+		__entry->index = index;
+		__entry->rc = rc;
+	),
+	TP_printk("ino=%lu index=%lu rc=%d",
+		__entry->ino, (unsigned long)__entry->index, __entry->rc)
+);
+
+TRACE_EVENT(teadfs_write_begin,
+	TP_PROTO(struct inode* inode, loff_t pos, unsigned len, int rc),
+	TP_ARGS(inode, pos, len, rc),
+	TP_STRUCT__entry(
+		__field(unsigned long, ino)
+		__field(loff_t, pos)
+		__field(unsigned, len)
+		__field(int, rc)
+	),
+	TP_fast_assign(
+		__entry->ino = inode->i_ino;
+		__entry->pos = pos;
+		__entry->len = len;
+		__entry->rc = rc;
+	),
+	TP_printk("ino=%lu pos=%lld len=%u rc=%d",
+		__entry->ino, __entry->pos, __entry->len, __entry->rc)
+);
+
+TRACE_EVENT(teadfs_write_end,
+	TP_PROTO(struct inode* inode, loff_t pos, unsigned len, unsigned copied, int rc),
+	TP_ARGS(inode, pos, len, copied, rc),
+	TP_STRUCT__entry(
+		__field(unsigned long, ino)
+		__field(loff_t, pos)
+		__field(unsigned, len)
+		__field(unsigned, copied)
+		__field(int, rc)
+	),
+	TP_fast_assign(
+		__entry->ino = inode->i_ino;
+		__entry->pos = pos;
+		__entry->len = len;
+		__entry->copied = copied;
+		__entry->rc = rc;
+	),
+	TP_printk("ino=%lu pos=%lld len=%u copied=%u rc=%d",
+		__entry->ino, __entry->pos, __entry->len, __entry->copied, __entry->rc)
+);
+
+#endif // !TEADFS_TRACE_H
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE teadfs_trace
+#include <trace/define_trace.h>
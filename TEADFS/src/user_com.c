@@ -5,13 +5,195 @@
 #include "global_param.h"
 #include "teadfs_header.h"
 #include "netlink.h"
+#include "stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "teadfs_trace.h"
 
 #include <linux/fs.h>
 #include <linux/sched.h>
+#include <linux/mm_types.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/cred.h>
+#include <linux/file.h>
+
+
+//max bytes of event records in one PR_MSG_EVENT
+#define TEADFS_EVENT_BATCH_SIZE 4096
+//events beyond it are dropped, never block the caller
+#define TEADFS_NOTIFY_MAX_EVENTS 1024
+
+/* one-way notify waiting to be sent to user mode. */
+struct teadfs_notify_item {
+	struct list_head list;
+	//PR_MSG_RELEASE or PR_MSG_EVENT
+	__u8 msg_type;
+	//process which caused the notify
+	pid_t pid;
+	//mount of the file, for stats. notifies are flushed before it goes
+	struct super_block* sb;
+	__u64 file_id;
+	//PR_MSG_RELEASE, referenced. granted to the daemon when sent, a burst of queued
+	//releases does not push their own grants out past TEADFS_FD_GRANTS_MAX
+	struct path lower_path;
+	//PR_MSG_RELEASE with PR_HELLO_IDENTITY, dir held while its path is sent
+	struct teadfs_file_identity identity;
+	struct dentry* dir;
+	unsigned int dir_epoch;
+	//TEADFS_EVENT_TYPE
+	__u32 event;
+	__u64 ino;
+	int file_path_size;
+	int new_file_path_size;
+	//file path, followed by new file path of events or directory path of release
+	char file_path[0];
+};
+
+static struct teadfs_notify_queue {
+	spinlock_t lock;
+	struct list_head item_list;
+	//queued PR_MSG_EVENT items
+	int event_count;
+	struct workqueue_struct* wq;
+	struct work_struct work;
+} teadfs_notify_queue;
+
+
+/* an upcall waiting for room in the window. */
+struct teadfs_upcall_waiter {
+	struct list_head list;
+	pid_t tgid;
+	struct task_struct* task;
+	//set with the slot taken, under the window lock
+	int granted;
+};
+
+void teadfs_upcall_window_init(struct teadfs_upcall_window* window) {
+	int i;
+
+	spin_lock_init(&window->lock);
+	window->inflight = 0;
+	window->bulk_inflight = 0;
+	for (i = 0; i < PR_PRIO_COUNT; i++)
+		INIT_LIST_HEAD(&window->waiters[i]);
+	window->last_bulk_tgid = 0;
+}
+
+//a quarter of the window is kept for metadata, bulk transforms never fill it
+static int teadfs_upcall_window_room(struct teadfs_sb_info* sbi, int priority) {
+	struct teadfs_upcall_window* window = &sbi->upcall_window;
+	unsigned int limit = sbi->opts.max_inflight;
+
+	if (window->inflight >= limit)
+		return 0;
+	if (PR_PRIO_BULK == priority && limit > 1)
+		return window->bulk_inflight < limit - max(1U, limit / 4);
+	return 1;
+}
+
+static void teadfs_upcall_window_take(struct teadfs_upcall_window* window, int priority, pid_t tgid) {
+	window->inflight++;
+	if (PR_PRIO_BULK == priority) {
+		window->bulk_inflight++;
+		window->last_bulk_tgid = tgid;
+	}
+}
+
+//hand free slots to waiters, metadata first, bulk round robin over processes. window lock held
+static void teadfs_upcall_window_grant(struct teadfs_sb_info* sbi) {
+	struct teadfs_upcall_window* window = &sbi->upcall_window;
+	struct teadfs_upcall_waiter* waiter;
+	struct teadfs_upcall_waiter* next;
+	int priority;
+
+	for (priority = 0; priority < PR_PRIO_COUNT; priority++) {
+		while (!list_empty(&window->waiters[priority]) && teadfs_upcall_window_room(sbi, priority)) {
+			waiter = list_first_entry(&window->waiters[priority], struct teadfs_upcall_waiter, list);
+			if (PR_PRIO_BULK == priority) {
+				list_for_each_entry(next, &window->waiters[priority], list) {
+					if (next->tgid != window->last_bulk_tgid) {
+						waiter = next;
+						break;
+					}
+				}
+			}
+			list_del(&waiter->list);
+			teadfs_upcall_window_take(window, priority, waiter->tgid);
+			waiter->granted = 1;
+			wake_up_process(waiter->task);
+		}
+	}
+}
+
+/**
+ * teadfs_upcall_window_enter
+ * @sbi: The mount
+ * @priority: PR_PRIO_* lane of the upcall
+ *
+ * @timeout: jiffies to wait at most, the mount's upcall timeout
+ *
+ * Wait for a slot of the max_inflight window. A waiter of the same lane
+ * queued before goes first, so a burst of bulk upcalls can not take the
+ * slots freed for metadata. Returns -EINTR on a fatal signal and
+ * -ETIMEDOUT when no slot came in time.
+ */
+static int teadfs_upcall_window_enter(struct teadfs_sb_info* sbi, int priority, unsigned long timeout) {
+	struct teadfs_upcall_window* window = &sbi->upcall_window;
+	struct teadfs_upcall_waiter waiter;
+	int rc = 0;
+
+	waiter.tgid = task_tgid_vnr(current);
+	spin_lock(&window->lock);
+	if (list_empty(&window->waiters[priority]) && teadfs_upcall_window_room(sbi, priority)) {
+		teadfs_upcall_window_take(window, priority, waiter.tgid);
+		spin_unlock(&window->lock);
+		return 0;
+	}
+	waiter.task = current;
+	waiter.granted = 0;
+	list_add_tail(&waiter.list, &window->waiters[priority]);
+	for (;;) {
+		set_current_state(TASK_KILLABLE);
+		if (waiter.granted)
+			break;
+		if (fatal_signal_pending(current)) {
+			rc = -EINTR;
+			break;
+		}
+		if (!timeout) {
+			rc = -ETIMEDOUT;
+			break;
+		}
+		spin_unlock(&window->lock);
+		timeout = schedule_timeout(timeout);
+		spin_lock(&window->lock);
+	}
+	__set_current_state(TASK_RUNNING);
+	if (rc) {
+		//never granted, the waiters queued behind may fit now
+		list_del(&waiter.list);
+		teadfs_upcall_window_grant(sbi);
+	}
+	spin_unlock(&window->lock);
+	return rc;
+}
+
+static void teadfs_upcall_window_leave(struct teadfs_sb_info* sbi, int priority) {
+	struct teadfs_upcall_window* window = &sbi->upcall_window;
 
+	spin_lock(&window->lock);
+	window->inflight--;
+	if (PR_PRIO_BULK == priority)
+		window->bulk_inflight--;
+	teadfs_upcall_window_grant(sbi);
+	spin_unlock(&window->lock);
+}
 
-// blocked current thead, to wait R3 deal.
-static void teadfs_request_wait_answer(struct teadfs_msg_ctx* ctx) {
+// blocked current thead, to wait R3 deal. -ETIMEDOUT if no answer
+static int teadfs_request_wait_answer(struct teadfs_msg_ctx* ctx, unsigned long timeout) {
 	int rc = 0;
 
 	LOG_DBG("ENTRY\n");
@@ -25,27 +207,51 @@ static void teadfs_request_wait_answer(struct teadfs_msg_ctx* ctx) {
 			break;
 		}
 		// wait R3 deal result
-		rc = wait_event_timeout(ctx->wait, ctx->state == TEADFS_MSG_CTX_STATE_DONE, 30 * HZ);
+		rc = wait_event_timeout(ctx->wait, ctx->state == TEADFS_MSG_CTX_STATE_DONE, timeout);
 		if (!rc) {
 			LOG_ERR("wait_event_timeout.\n");
+			trace_teadfs_upcall_timeout(ctx->msg_id, ctx->msg_type, ctx->request_msg_size, ctx->ino);
 			mutex_lock(&(ctx->mux));
 			ctx->state = TEADFS_MSG_CTX_STATE_DONE;
 			ctx->response_msg_size = 0;
 			ctx->response_msg = NULL;
 			mutex_unlock(&(ctx->mux));
+			rc = -ETIMEDOUT;
 			break;
 		}
+		trace_teadfs_upcall_wakeup(ctx->msg_id, ctx->msg_type, ctx->response_msg_size, ctx->ino);
+		rc = 0;
 	} while (0);
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
-	return;
+	return rc;
 }
 
-static int teadfs_request_send(__u64 msg_id, size_t request_size, char* request_data, size_t* response_size, char** response_data) {
+static int teadfs_request_send(struct inode* inode, __u64 msg_id, size_t request_size, char* request_data, size_t* response_size, char** response_data) {
 	int rc = 0;
 	struct teadfs_msg_ctx* ctx, *tmp_ctx;
+	unsigned long ino = inode ? inode->i_ino : 0;
+	struct super_block* sb = inode ? inode->i_sb : NULL;
+	struct teadfs_sb_info* sbi = sb ? teadfs_get_super_block(sb) : NULL;
+	struct teadfs_session* session = teadfs_sb_session(sb);
+	unsigned long timeout = 30 * HZ;
+	int limited = 0;
+	int priority = ((struct teadfs_packet_info*)request_data)->header.priority;
+	u64 start_ns;
 
 	LOG_DBG("ENTRY\n");
+	if (sbi) {
+		timeout = sbi->opts.upcall_timeout * HZ;
+	}
 	do {
+		//max_inflight mount option
+		if (sbi && sbi->opts.max_inflight) {
+			rc = teadfs_upcall_window_enter(sbi, priority, timeout);
+			if (rc) {
+				break;
+			}
+			limited = 1;
+		}
+		start_ns = local_clock();
 		// alloc memory
 		ctx = teadfs_zalloc(sizeof(struct teadfs_msg_ctx), GFP_KERNEL);
 		if (!ctx) {
@@ -55,6 +261,8 @@ static int teadfs_request_send(__u64 msg_id, size_t request_size, char* request_
 		// init struct teadfs_msg_ctx
 		ctx->state = TEADFS_MSG_CTX_STATE_PENDING;
 		ctx->msg_id = msg_id;
+		ctx->msg_type = ((struct teadfs_packet_info*)request_data)->header.msg_type;
+		ctx->ino = ino;
 		ctx->request_msg_size = request_size;
 		ctx->request_msg = request_data;
 		ctx->response_msg_size = 0;
@@ -63,25 +271,36 @@ static int teadfs_request_send(__u64 msg_id, size_t request_size, char* request_
 		init_waitqueue_head(&(ctx->wait));
 
 		//add list
-		mutex_lock(&teadfs_get_msg_queue()->mux);
-		list_add_tail(&ctx->out_list, &teadfs_get_msg_queue()->msg_ctx_queue);
-		mutex_unlock(&teadfs_get_msg_queue()->mux);
+		mutex_lock(&teadfs_get_msg_queue(session)->mux);
+		list_add_tail(&ctx->out_list, &teadfs_get_msg_queue(session)->msg_ctx_queue);
+		mutex_unlock(&teadfs_get_msg_queue(session)->mux);
+		trace_teadfs_upcall_enqueue(msg_id, ctx->msg_type, request_size, ino);
 
-		teadfs_send_to_user(request_data, request_size);
+		if (teadfs_send_to_user(teadfs_get_client_pid(session), request_data, request_size) < 0) {
+			teadfs_stats_inc(sb, TS_SEND_DROP);
+		}
+		trace_teadfs_upcall_send(msg_id, ctx->msg_type, request_size, ino);
 		//request usr answer
-		teadfs_request_wait_answer(ctx);
+		if (teadfs_request_wait_answer(ctx, timeout)) {
+			teadfs_stats_inc(sb, TS_TIMEOUT);
+		} else {
+			teadfs_stats_upcall(sb, ctx->msg_type, start_ns);
+		}
 
 		//result
 		*response_size = ctx->response_msg_size;
 		*response_data = ctx->response_msg;
 
 		// delete in list
-		mutex_lock(&teadfs_get_msg_queue()->mux);
+		mutex_lock(&teadfs_get_msg_queue(session)->mux);
 		list_del(&ctx->out_list);
-		mutex_unlock(&teadfs_get_msg_queue()->mux);
+		mutex_unlock(&teadfs_get_msg_queue(session)->mux);
 		//free mem
 		teadfs_free(ctx);
 	} while (0);
+	if (limited) {
+		teadfs_upcall_window_leave(sbi, priority);
+	}
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
@@ -92,6 +311,9 @@ static void teadfs_packet_header(struct teadfs_packet_info* packet, int size, __
 	packet->header.msg_id = teadfs_get_next_msg_id();
 	packet->header.msg_type = msg_type;
 	packet->header.initiator = initiator;
+	packet->header.flags = 0;
+	//data transforms queue behind the verdicts an opener waits on
+	packet->header.priority = (PR_MSG_READ == msg_type || PR_MSG_WRITE == msg_type) ? PR_PRIO_BULK : PR_PRIO_META;
 	packet->header.pid = pid;
 	packet->header.uid = uid;
 	packet->header.gid = gid;
@@ -101,43 +323,256 @@ static void teadfs_packet_header(struct teadfs_packet_info* packet, int size, __
 
 
 
-static int teadfs_request_open(char* file_path_start, int file_path_size, struct file* file) {
+/* name of the file in an open or release upcall */
+struct teadfs_file_name {
+	char* buf;
+	//leaf name with PR_HELLO_IDENTITY, otherwise the full lower path
+	char* file_path;
+	int file_path_size;
+	//lower path of identity.dir_id when the daemon has not got it, else 0 size
+	char* dir_path;
+	int dir_path_size;
+	struct teadfs_file_identity identity;
+	//parent directory, held while its path is on the way
+	struct dentry* dir;
+	unsigned int dir_epoch;
+};
+
+/**
+ * teadfs_get_file_name
+ * @session: daemon the upcall goes to
+ * @dentry: upper dentry of the file
+ * @announce: send the directory path even if the daemon should have it
+ * @name: put it with teadfs_put_file_name
+ *
+ * A daemon bound with PR_HELLO_IDENTITY gets the lower identity of the
+ * file, the leaf name and an id of its directory. The directory path is
+ * only resolved until the daemon got it at the current name epoch.
+ * Other daemons get the full lower path.
+ */
+static int teadfs_get_file_name(struct teadfs_session* session, struct dentry* dentry, int announce,
+	struct teadfs_file_name* name) {
+	struct teadfs_inode_info* dir_info;
+	struct inode* lower_inode;
+	struct path lower_path;
+	char* path;
+	int rc = 0;
+
+	memset(name, 0, sizeof(struct teadfs_file_name));
+	name->buf = teadfs_zalloc(PATH_MAX, GFP_KERNEL);
+	if (!name->buf) {
+		return -ENOMEM;
+	}
+	do {
+		if (!(teadfs_get_client_features(session) & PR_HELLO_IDENTITY) || !dentry->d_inode) {
+			teadfs_get_lower_path(dentry, &lower_path);
+			path = d_path(&lower_path, name->buf, PATH_MAX);
+			teadfs_put_lower_path(dentry, &lower_path);
+			if (IS_ERR(path)) {
+				rc = PTR_ERR(path);
+				break;
+			}
+			name->file_path = path;
+			name->file_path_size = strlen(path);
+			break;
+		}
+		lower_inode = teadfs_inode_to_lower(dentry->d_inode);
+		name->identity.dev = new_encode_dev(lower_inode->i_sb->s_dev);
+		name->identity.generation = lower_inode->i_generation;
+		name->identity.ino = lower_inode->i_ino;
+		//leaf name first, the directory path is put after NAME_MAX
+		spin_lock(&dentry->d_lock);
+		name->file_path_size = min_t(int, dentry->d_name.len, NAME_MAX);
+		memcpy(name->buf, dentry->d_name.name, name->file_path_size);
+		spin_unlock(&dentry->d_lock);
+		name->file_path = name->buf;
+
+		name->dir = dget_parent(dentry);
+		dir_info = teadfs_inode_to_private(name->dir->d_inode);
+		name->dir_epoch = teadfs_get_name_epoch(session);
+		spin_lock(&name->dir->d_inode->i_lock);
+		if (!dir_info->dir_id) {
+			dir_info->dir_id = teadfs_get_next_msg_id();
+		}
+		name->identity.dir_id = dir_info->dir_id;
+		if (dir_info->dir_epoch != name->dir_epoch) {
+			announce = 1;
+		}
+		spin_unlock(&name->dir->d_inode->i_lock);
+		if (!announce) {
+			break;
+		}
+		teadfs_get_lower_path(name->dir, &lower_path);
+		path = d_path(&lower_path, name->buf + NAME_MAX + 1, PATH_MAX - NAME_MAX - 1);
+		teadfs_put_lower_path(name->dir, &lower_path);
+		if (IS_ERR(path)) {
+			rc = PTR_ERR(path);
+			break;
+		}
+		name->dir_path = path;
+		name->dir_path_size = strlen(path);
+	} while (0);
+	if (rc) {
+		LOG_ERR("d_path error:%d\n", rc);
+	}
+	return rc;
+}
+
+//user mode got the message, it knows the directory path now
+static void teadfs_file_name_sent(struct teadfs_file_name* name) {
+	struct teadfs_inode_info* dir_info;
+
+	if (!name->dir || !name->dir_path_size) {
+		return;
+	}
+	dir_info = teadfs_inode_to_private(name->dir->d_inode);
+	spin_lock(&name->dir->d_inode->i_lock);
+	dir_info->dir_epoch = name->dir_epoch;
+	spin_unlock(&name->dir->d_inode->i_lock);
+}
+
+static void teadfs_put_file_name(struct teadfs_file_name* name) {
+	if (name->dir) {
+		dput(name->dir);
+		name->dir = NULL;
+	}
+	if (name->buf) {
+		teadfs_free(name->buf);
+		name->buf = NULL;
+	}
+}
+
+/**
+ * teadfs_read_open_header
+ * @inode: upper inode being opened, may be NULL
+ * @lower_path: lower path of the inode, may be NULL
+ * @header: ENCRYPT_FILE_HEADER_SIZE bytes
+ * @header_size: bytes of the header read
+ *
+ * Read the label header of the lower file for the open upcall, so user
+ * mode can give the verdict without opening the file again. Page 0 of
+ * the lower page cache is used when it is up to date, otherwise the
+ * lower file is opened with the caller credentials. Returns the
+ * PR_OPEN_HEADER_* flags, 0 when the header could not be read.
+ */
+static __u32 teadfs_read_open_header(struct inode* inode, struct path* lower_path, char* header, int* header_size) {
+	struct inode* lower_inode;
+	struct file* lower_file;
+	struct page* page;
+	char* virt;
+	__u32 flags = 0;
+	int rc = 0;
+
+	*header_size = 0;
+	if (!inode || !S_ISREG(inode->i_mode)) {
+		return 0;
+	}
+	lower_inode = teadfs_inode_to_lower(inode);
+	*header_size = (int)min_t(loff_t, i_size_read(lower_inode), ENCRYPT_FILE_HEADER_SIZE);
+	if (*header_size < ENCRYPT_FILE_HEADER_SIZE) {
+		flags |= PR_OPEN_HEADER_SHORT;
+	}
+	if (!*header_size) {
+		return flags | PR_OPEN_HEADER_VALID;
+	}
+	//cached first page spares the lower open
+	page = find_get_page(lower_inode->i_mapping, 0);
+	if (page) {
+		if (PageUptodate(page)) {
+			virt = kmap(page);
+			memcpy(header, virt, *header_size);
+			kunmap(page);
+			flags |= PR_OPEN_HEADER_VALID;
+		}
+		page_cache_release(page);
+		if (flags & PR_OPEN_HEADER_VALID) {
+			return flags;
+		}
+	}
+	do {
+		if (!lower_path) {
+			break;
+		}
+		lower_file = dentry_open(lower_path, O_RDONLY | O_LARGEFILE, current_cred());
+		if (IS_ERR(lower_file)) {
+			LOG_DBG("header open error:%ld\n", PTR_ERR(lower_file));
+			break;
+		}
+		rc = kernel_read(lower_file, 0, header, *header_size);
+		fput(lower_file);
+		if (rc < 0) {
+			LOG_DBG("header read error:%d\n", rc);
+			break;
+		}
+		//truncated since the size was taken
+		if (rc < *header_size) {
+			*header_size = rc;
+			flags |= PR_OPEN_HEADER_SHORT;
+		}
+		return flags | PR_OPEN_HEADER_VALID;
+	} while (0);
+	//user mode reads it itself
+	*header_size = 0;
+	return 0;
+}
+
+static int teadfs_request_open(struct inode* inode, struct teadfs_file_name* name, struct file* file,
+	struct path* lower_path) {
 	char* buffer_packet = NULL;
 	int buffer_size = 0;
+	char* header = NULL;
+	int header_size = 0;
+	__u32 header_flags = 0;
+	__u64 fd_token = 0;
 	int rc = 0;
 	pid_t kpid = 0;
 	struct teadfs_packet_info* packet = NULL;
 	char* response_data = NULL;
 	size_t response_size = 0;
+	struct teadfs_session* session = teadfs_sb_session(inode ? inode->i_sb : NULL);
 
 	LOG_DBG("ENTRY\n");
 	do {
-		if (!teadfs_get_client_connect()) {
+		if (!teadfs_get_client_connect(session)) {
 			rc = -ENOMEM;
 			break;
 		}
 		//get current process id
 		kpid = task_tgid_vnr(current);
 		//ignore client proces
-		if (kpid == teadfs_get_client_pid()) {
+		if (kpid == teadfs_get_client_pid(session)) {
 			rc = -ENOMEM;
 			break;
 		}
 		//packet data ro usr
-		buffer_size = sizeof(struct teadfs_packet_info) + file_path_size;
-		buffer_packet = teadfs_zalloc(sizeof(struct teadfs_packet_info) + file_path_size, GFP_KERNEL);
+		buffer_size = sizeof(struct teadfs_packet_info) + name->file_path_size + name->dir_path_size + ENCRYPT_FILE_HEADER_SIZE;
+		buffer_packet = teadfs_zalloc(buffer_size, GFP_KERNEL);
 		if (!buffer_packet) {
 			rc = -ENOMEM;
 			break;
 		}
+		header = buffer_packet + sizeof(struct teadfs_packet_info) + name->file_path_size + name->dir_path_size;
+		header_flags = teadfs_read_open_header(inode, lower_path, header, &header_size);
+		buffer_size -= ENCRYPT_FILE_HEADER_SIZE - header_size;
 		packet = (struct teadfs_packet_info *)(buffer_packet);
 		//add header info
 		teadfs_packet_header(packet, buffer_size, PR_MSG_OPEN, 0, kpid, KUIDT_INIT(0), KGIDT_INIT(0));
 		
-		packet->data.open.file_id = (__u64)file;
-		packet->data.open.file_path.size = file_path_size;
+		packet->data.open.file_id = file ? teadfs_file_to_private(file)->file_id : 0;
+		packet->data.open.file_path.size = name->file_path_size;
 		packet->data.open.file_path.offset = sizeof(struct teadfs_packet_info);
-		memcpy(buffer_packet + sizeof(struct teadfs_packet_info), file_path_start, file_path_size);
+		memcpy(buffer_packet + sizeof(struct teadfs_packet_info), name->file_path, name->file_path_size);
+		packet->data.open.identity = name->identity;
+		packet->data.open.identity.dir_path.size = name->dir_path_size;
+		packet->data.open.identity.dir_path.offset = sizeof(struct teadfs_packet_info) + name->file_path_size;
+		memcpy(buffer_packet + packet->data.open.identity.dir_path.offset, name->dir_path, name->dir_path_size);
+		packet->data.open.header.size = header_size;
+		packet->data.open.header.offset = (__u32)(header - buffer_packet);
+		packet->data.open.header_flags = header_flags;
+		if (lower_path && inode && S_ISREG(inode->i_mode)) {
+			fd_token = teadfs_grant_fd(session, inode->i_sb, lower_path, O_RDONLY, PR_HELLO_OPEN_FD);
+		}
+		packet->data.open.fd_token = fd_token;
 
 		LOG_DBG("size:%d, msg_id:0x%llx, msg_type:%d, pid:%d, uid:%d, gid:%d\n"
 			, packet->header.size
@@ -147,10 +582,11 @@ static int teadfs_request_open(char* file_path_start, int file_path_size, struct
 			, packet->header.uid
 			, packet->header.gid
 		);
-		LOG_DBG("path:%s", buffer_packet + sizeof(struct teadfs_packet_info));
+		LOG_DBG("path:%.*s, dir:%llu, header size:%d, flags:0x%x\n", name->file_path_size, name->file_path,
+			name->identity.dir_id, header_size, header_flags);
 
 		//send to usr
-		rc = teadfs_request_send(packet->header.msg_id, buffer_size, buffer_packet, &response_size, &response_data);
+		rc = teadfs_request_send(inode, packet->header.msg_id, buffer_size, buffer_packet, &response_size, &response_data);
 		if (rc) {
 			rc = -ENOMEM;
 			break;
@@ -160,10 +596,13 @@ static int teadfs_request_open(char* file_path_start, int file_path_size, struct
 			rc = -ENOMEM;
 			break;
 		}
+		teadfs_file_name_sent(name);
 		packet = (struct teadfs_packet_info*)response_data;
 		//get file access code. is OPEN_FILE_RESULT
 		rc = packet->data.code.error_code;
 	} while (0);
+	//the fd is only good while the opener waits
+	teadfs_revoke_fd(session, fd_token);
 
 	//release mem
 	if (response_data) {
@@ -177,127 +616,404 @@ static int teadfs_request_open(char* file_path_start, int file_path_size, struct
 	return rc;
 }
 
-int teadfs_request_open_file(struct file* file, struct teadfs_file_info* file_info) {
+/**
+ * teadfs_request_open_named
+ * @dentry: upper dentry of the file, may be NULL with a full path name
+ *
+ * Send the open upcall. A daemon which lost the path of the directory id
+ * answers PR_OPEN_NEED_PATH, the open is then sent once more with it.
+ */
+static int teadfs_request_open_named(struct inode* inode, struct dentry* dentry, struct teadfs_file_name* name,
+	struct file* file, struct path* lower_path) {
+	int rc;
+
+	rc = teadfs_request_open(inode, name, file, lower_path);
+	if (PR_OPEN_NEED_PATH == rc && dentry && name->identity.dir_id && !name->dir_path_size) {
+		LOG_DBG("directory %llu path asked\n", name->identity.dir_id);
+		teadfs_put_file_name(name);
+		rc = teadfs_get_file_name(teadfs_sb_session(dentry->d_sb), dentry, 1, name);
+		if (!rc) {
+			rc = teadfs_request_open(inode, name, file, lower_path);
+		}
+	}
+	if (PR_OPEN_NEED_PATH == rc) {
+		rc = -ENOENT;
+	}
+	return rc;
+}
+
+//executable of current process, referenced. flights only compare it by address
+static struct file* teadfs_get_current_exe(void) {
+	struct mm_struct* mm = current->mm;
+	struct file* exe_file;
+
+	if (!mm) {
+		return NULL;
+	}
+#ifdef CONFIG_GET_MM_EXE_FILE
+	exe_file = get_mm_exe_file(mm);
+#else
+	//get_mm_exe_file is not exported, exe_file only changes under mmap_sem
+	down_read(&mm->mmap_sem);
+	exe_file = mm->exe_file;
+	if (exe_file) {
+		get_file(exe_file);
+	}
+	up_read(&mm->mmap_sem);
+#endif
+	return exe_file;
+}
+
+static void teadfs_put_open_flight(struct teadfs_open_flight* flight) {
+	if (atomic_dec_and_test(&flight->count)) {
+		if (flight->exe_id) {
+			fput(flight->exe_id);
+		}
+		teadfs_free(flight);
+	}
+}
+
+//take a cached verdict out of the list, open_flight_lock held
+static void teadfs_unlink_open_verdict(struct teadfs_inode_info* inode_info, struct teadfs_open_flight* flight) {
+	list_del(&flight->list);
+	inode_info->open_verdicts--;
+	teadfs_put_open_flight(flight);
+}
+
+//keep the verdict of a finished upcall, open_flight_lock held. false if not cached
+static int teadfs_cache_open_verdict(struct teadfs_inode_info* inode_info, struct teadfs_open_flight* flight,
+	struct teadfs_mount_opts* opts) {
+	struct teadfs_open_flight* iter, *tmp;
+
+	if (!opts->verdict_ttl || !opts->verdict_cache || flight->result < 0 || !flight->exe_id) {
+		return 0;
+	}
+	//oldest verdicts go first
+	list_for_each_entry_safe(iter, tmp, &inode_info->open_flights, list) {
+		if (inode_info->open_verdicts < opts->verdict_cache) {
+			break;
+		}
+		if (iter->cached) {
+			teadfs_unlink_open_verdict(inode_info, iter);
+		}
+	}
+	flight->cached = 1;
+	flight->expires = jiffies + msecs_to_jiffies(opts->verdict_ttl);
+	atomic_inc(&flight->count);
+	inode_info->open_verdicts++;
+	return 1;
+}
+
+/**
+ * teadfs_request_open_single
+ * @inode: upper inode being opened, may be NULL
+ * @dentry: upper dentry of the file, may be NULL with a full path name
+ * @name: file name sent to user mode
+ * @lower_path: lower path of the inode, the header is read through it
+ *
+ * Concurrent open verdict requests by getattr and truncate for the same
+ * inode by the same executable are answered by a single upcall. Later
+ * arrivals wait for the request in flight and reuse its result. With the
+ * verdict_ttl mount option the result is also reused until it expires.
+ * Opens of a file always send their own upcall, user mode pairs each
+ * file_id with its release.
+ */
+static int teadfs_request_open_single(struct inode* inode, struct dentry* dentry, struct teadfs_file_name* name,
+	struct file* file, struct path* lower_path) {
+	struct teadfs_inode_info* inode_info;
+	struct teadfs_mount_opts* opts;
+	struct teadfs_open_flight* flight, *iter, *tmp;
+	struct file* exe_id;
+	int joined = 0;
 	int rc = 0;
-	// get file path
+
+	LOG_DBG("ENTRY\n");
 	do {
-		file_info->file_path_buf = teadfs_zalloc(PATH_MAX, GFP_KERNEL);
-		if (!(file_info->file_path_buf)) {
+		//client process is never blocked behind other openers
+		if (!inode || file || task_tgid_vnr(current) == teadfs_get_client_pid(teadfs_sb_session(inode->i_sb))) {
+			rc = teadfs_request_open_named(inode, dentry, name, file, lower_path);
+			break;
+		}
+		inode_info = teadfs_inode_to_private(inode);
+		opts = &teadfs_get_super_block(inode->i_sb)->opts;
+		exe_id = teadfs_get_current_exe();
+		flight = teadfs_zalloc(sizeof(struct teadfs_open_flight), GFP_KERNEL);
+		if (!flight) {
+			if (exe_id) {
+				fput(exe_id);
+			}
 			rc = -ENOMEM;
 			break;
 		}
-		file_info->file_path = d_path(&file->f_path, file_info->file_path_buf, PATH_MAX);
-		file_info->file_path_length = strlen(file_info->file_path);
+		flight->exe_id = exe_id;
+		atomic_set(&flight->count, 1);
+		init_completion(&flight->done);
+
+		spin_lock(&inode_info->open_flight_lock);
+		list_for_each_entry_safe(iter, tmp, &inode_info->open_flights, list) {
+			if (iter->exe_id != exe_id) {
+				continue;
+			}
+			if (iter->cached && time_after_eq(jiffies, iter->expires)) {
+				teadfs_unlink_open_verdict(inode_info, iter);
+				continue;
+			}
+			atomic_inc(&iter->count);
+			//ours never got listed, its executable is put below
+			teadfs_free(flight);
+			flight = iter;
+			joined = 1;
+			break;
+		}
+		if (!joined) {
+			list_add_tail(&flight->list, &inode_info->open_flights);
+			spin_unlock(&inode_info->open_flight_lock);
+			//first opener, send the upcall
+			rc = teadfs_request_open_named(inode, dentry, name, file, lower_path);
+			flight->result = rc;
+			spin_lock(&inode_info->open_flight_lock);
+			if (!teadfs_cache_open_verdict(inode_info, flight, opts)) {
+				list_del(&flight->list);
+			}
+			spin_unlock(&inode_info->open_flight_lock);
+			complete_all(&flight->done);
+		} else {
+			spin_unlock(&inode_info->open_flight_lock);
+			if (exe_id) {
+				fput(exe_id);
+			}
+			//wait the upcall in flight, the leader keeps its own reference
+			if (wait_for_completion_killable(&flight->done)) {
+				rc = -EINTR;
+			} else {
+				rc = flight->result;
+				LOG_DBG("coalesced open verdict:%d\n", rc);
+			}
+		}
+		teadfs_put_open_flight(flight);
+	} while (0);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+void teadfs_drop_open_verdicts(struct inode* inode) {
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+	struct teadfs_open_flight* iter, *tmp;
+
+	spin_lock(&inode_info->open_flight_lock);
+	list_for_each_entry_safe(iter, tmp, &inode_info->open_flights, list) {
+		if (iter->cached) {
+			teadfs_unlink_open_verdict(inode_info, iter);
+		}
+	}
+	spin_unlock(&inode_info->open_flight_lock);
+}
+
+int teadfs_request_open_file(struct file* file, struct teadfs_file_info* file_info) {
+	struct teadfs_session* session = teadfs_sb_session(file_inode(file)->i_sb);
+	struct teadfs_file_name name;
+	struct path lower_path;
+	int rc = 0;
+
+	memset(&name, 0, sizeof(struct teadfs_file_name));
+	teadfs_get_lower_path(file->f_path.dentry, &lower_path);
+	// get file path
+	do {
+		//named by identity, the path is not resolved on each open
+		if (teadfs_get_client_features(session) & PR_HELLO_IDENTITY) {
+			rc = teadfs_get_file_name(session, file->f_path.dentry, 0, &name);
+			if (rc) {
+				break;
+			}
+		} else {
+			file_info->file_path_buf = teadfs_zalloc(PATH_MAX, GFP_KERNEL);
+			if (!(file_info->file_path_buf)) {
+				rc = -ENOMEM;
+				break;
+			}
+			//the lower path, the one events and stat carry too
+			file_info->file_path = d_path(&lower_path, file_info->file_path_buf, PATH_MAX);
+			if (IS_ERR(file_info->file_path)) {
+				rc = PTR_ERR(file_info->file_path);
+				file_info->file_path = NULL;
+				break;
+			}
+			file_info->file_path_length = strlen(file_info->file_path);
+			name.file_path = file_info->file_path;
+			name.file_path_size = file_info->file_path_length;
+		}
 
-		rc = teadfs_request_open(file_info->file_path, file_info->file_path_length, file);
+		rc = teadfs_request_open_single(file_inode(file), file->f_path.dentry, &name, file, &lower_path);
 	} while (0);
-	LOG_INF("file:%s\n", file_info->file_path);
+	teadfs_put_lower_path(file->f_path.dentry, &lower_path);
+	LOG_INF("file:%.*s\n", name.file_path_size, name.file_path);
+	teadfs_put_file_name(&name);
 	if (rc < 0) { 
 		rc = OFR_INIT; 
 	}
+	teadfs_stats_verdict(file_inode(file)->i_sb, rc);
 	return rc;
 }
 
 
-int teadfs_request_open_path(struct path* path) {
+int teadfs_request_open_path(struct inode* inode, struct dentry* dentry, struct path* path) {
 	int rc = 0;
-	char* buffer_file_path = NULL;
-	int file_path_size = 0;
-	char* file_path_start = NULL;
+	struct teadfs_file_name name;
 
-	// get file path
+	// get file path, the lower one
 	do {
-		buffer_file_path = teadfs_zalloc(PATH_MAX, GFP_KERNEL);
-		if (!buffer_file_path) {
-			rc = -ENOMEM;
+		rc = teadfs_get_file_name(teadfs_sb_session(dentry->d_sb), dentry, 0, &name);
+		if (rc) {
 			break;
 		}
-		file_path_start = d_path(path, buffer_file_path, PATH_MAX);
-		file_path_size = strlen(file_path_start);
 
-		rc = teadfs_request_open(file_path_start, file_path_size, NULL);
+		rc = teadfs_request_open_single(inode, dentry, &name, NULL, path);
+		teadfs_stats_verdict(inode ? inode->i_sb : NULL, rc < 0 ? OFR_INIT : rc);
 	} while (0);
 
-	LOG_INF("file:%s\n", file_path_start);
-	if (buffer_file_path) {
-		teadfs_free(buffer_file_path);
-	}
+	LOG_INF("file:%.*s\n", name.file_path_size, name.file_path);
+	teadfs_put_file_name(&name);
 	return rc;
 }
 
-//close file to user mode
-int teadfs_request_release(char* file_path_start, int file_path_size, struct file* file) {
+//send queued release to user mode. one-way, the result is not waited
+static int teadfs_send_release(struct teadfs_notify_item* item) {
 	char* buffer_packet = NULL;
 	int buffer_size = 0;
+	__u64 fd_token = 0;
 	int rc = 0;
-	pid_t kpid = 0;
 	struct teadfs_packet_info* packet = NULL;
-	char* response_data = NULL;
-	size_t response_size = 0;
+	struct teadfs_session* session = teadfs_sb_session(item->sb);
 
 	LOG_DBG("ENTRY\n");
-	LOG_INF("%s\n", file_path_start);
 	do {
-		if (!teadfs_get_client_connect()) {
-			rc = -ENOMEM;
-			break;
-		}
-		if (!(file) || !(file->f_path.dentry) || !(file->f_path.mnt)) {
-			LOG_ERR("error file\n");
-			rc = -ENOMEM;
-			break;
-		}
-		//get current process id
-		kpid = task_tgid_vnr(current);
-		//ignore client proces
-		if (kpid == teadfs_get_client_pid()) {
+		if (!teadfs_get_client_connect(session)) {
 			rc = -ENOMEM;
 			break;
 		}
 		//packet data ro usr
-		buffer_size = sizeof(struct teadfs_packet_info) + file_path_size;
-		buffer_packet = teadfs_zalloc(sizeof(struct teadfs_packet_info) + file_path_size, GFP_KERNEL);
+		buffer_size = sizeof(struct teadfs_packet_info) + item->file_path_size + item->new_file_path_size;
+		buffer_packet = teadfs_zalloc(buffer_size, GFP_KERNEL);
 		if (!buffer_packet) {
 			rc = -ENOMEM;
 			break;
 		}
 		packet = (struct teadfs_packet_info*)(buffer_packet);
 		//add header info
-		teadfs_packet_header(packet, buffer_size, PR_MSG_RELEASE, 0, kpid, KUIDT_INIT(0), KGIDT_INIT(0));
+		teadfs_packet_header(packet, buffer_size, PR_MSG_RELEASE, 0, item->pid, KUIDT_INIT(0), KGIDT_INIT(0));
+		packet->header.flags |= PR_FLAG_NO_REPLY;
 
-		packet->data.release.file_id = (__u64)file;
-		packet->data.release.file_path.size = file_path_size;
+		packet->data.release.file_id = item->file_id;
+		packet->data.release.file_path.size = item->file_path_size;
 		packet->data.release.file_path.offset = sizeof(struct teadfs_packet_info);
-		memcpy(buffer_packet + sizeof(struct teadfs_packet_info), file_path_start, file_path_size);
+		memcpy(buffer_packet + sizeof(struct teadfs_packet_info), item->file_path, item->file_path_size + item->new_file_path_size);
+		//the daemon labels the file through it, kept until taken
+		if (item->lower_path.dentry) {
+			fd_token = teadfs_grant_fd(session, item->sb, &item->lower_path, O_RDWR, PR_HELLO_RELEASE_FD);
+		}
+		packet->data.release.fd_token = fd_token;
+		packet->data.release.identity = item->identity;
+		packet->data.release.identity.dir_path.size = item->new_file_path_size;
+		packet->data.release.identity.dir_path.offset = sizeof(struct teadfs_packet_info) + item->file_path_size;
 
-		LOG_DBG("size:%d, msg_id:0x%llx, msg_type:%d, pid:%d, uid:%d, gid:%d\n"
+		LOG_DBG("size:%d, msg_id:0x%llx, msg_type:%d, pid:%d\n"
 			, packet->header.size
 			, packet->header.msg_id
 			, packet->header.msg_type
 			, packet->header.pid
-			, packet->header.uid
-			, packet->header.gid
 		);
-		LOG_DBG("path:%s", buffer_packet + sizeof(struct teadfs_packet_info));
-
 		//send to usr
-		rc = teadfs_request_send(packet->header.msg_id, buffer_size, buffer_packet, &response_size, &response_data);
-		if (rc) {
+		rc = teadfs_send_to_user(teadfs_get_client_pid(session), buffer_packet, buffer_size);
+		trace_teadfs_upcall_send(packet->header.msg_id, PR_MSG_RELEASE, buffer_size, item->ino);
+		if (rc < 0) {
+			LOG_ERR("teadfs_send_to_user, error:%d\n", rc);
+			teadfs_stats_inc(item->sb, TS_SEND_DROP);
+			break;
+		}
+		teadfs_stats_inc(item->sb, TS_NOTIFY_RELEASE);
+		rc = 0;
+	} while (0);
+	//not sent, nobody takes it
+	if (rc) {
+		teadfs_revoke_fd(session, fd_token);
+	}
+	if (item->lower_path.dentry) {
+		path_put(&item->lower_path);
+	}
+	if (item->dir) {
+		//user mode knows the directory path now
+		if (!rc && item->new_file_path_size) {
+			spin_lock(&item->dir->d_inode->i_lock);
+			teadfs_inode_to_private(item->dir->d_inode)->dir_epoch = item->dir_epoch;
+			spin_unlock(&item->dir->d_inode->i_lock);
+		}
+		dput(item->dir);
+	}
+	//release mem
+	if (buffer_packet) {
+		teadfs_free(buffer_packet);
+	}
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+static size_t teadfs_event_record_size(struct teadfs_notify_item* item) {
+	return ALIGN(sizeof(struct teadfs_event_record) + item->file_path_size + item->new_file_path_size, 8);
+}
+
+//send batched events of one session in one message. items are released
+static int teadfs_send_events(struct teadfs_session* session, struct list_head* batch, int count, size_t size) {
+	char* buffer_packet = NULL;
+	int buffer_size = 0;
+	int rc = 0;
+	struct teadfs_packet_info* packet = NULL;
+	struct teadfs_event_record* record = NULL;
+	struct teadfs_notify_item* item, *tmp;
+
+	LOG_DBG("ENTRY count:%d\n", count);
+	do {
+		if (!teadfs_get_client_connect(session)) {
 			rc = -ENOMEM;
 			break;
 		}
-		if ((NULL == response_data) || (response_size < sizeof(struct teadfs_packet_info))) {
-			LOG_ERR("Get Message Size Error, size:%d\n", response_size);
+		buffer_size = sizeof(struct teadfs_packet_info) + size;
+		buffer_packet = teadfs_zalloc(buffer_size, GFP_KERNEL);
+		if (!buffer_packet) {
 			rc = -ENOMEM;
 			break;
 		}
-		packet = (struct teadfs_packet_info*)response_data;
-		//get file release code. is RELEASE_FILE_RESULT
-		rc = packet->data.code.error_code;
+		packet = (struct teadfs_packet_info*)(buffer_packet);
+		teadfs_packet_header(packet, buffer_size, PR_MSG_EVENT, 0, 0, KUIDT_INIT(0), KGIDT_INIT(0));
+		packet->header.flags |= PR_FLAG_NO_REPLY;
+		packet->data.event.count = count;
+		packet->data.event.events.size = size;
+		packet->data.event.events.offset = sizeof(struct teadfs_packet_info);
+
+		record = (struct teadfs_event_record*)(buffer_packet + sizeof(struct teadfs_packet_info));
+		list_for_each_entry(item, batch, list) {
+			record->size = teadfs_event_record_size(item);
+			record->event = item->event;
+			record->ino = item->ino;
+			record->file_path.size = item->file_path_size;
+			record->file_path.offset = sizeof(struct teadfs_event_record);
+			record->new_file_path.size = item->new_file_path_size;
+			record->new_file_path.offset = sizeof(struct teadfs_event_record) + item->file_path_size;
+			memcpy((char*)record + record->file_path.offset, item->file_path, item->file_path_size + item->new_file_path_size);
+			record = (struct teadfs_event_record*)((char*)record + record->size);
+		}
+		rc = teadfs_send_to_user(teadfs_get_client_pid(session), buffer_packet, buffer_size);
+		trace_teadfs_upcall_send(packet->header.msg_id, PR_MSG_EVENT, buffer_size, 0);
+		if (rc < 0) {
+			LOG_ERR("teadfs_send_to_user, error:%d\n", rc);
+			break;
+		}
+		rc = 0;
 	} while (0);
 	//release mem
-	if (response_data) {
-		teadfs_free(response_data);
+	list_for_each_entry_safe(item, tmp, batch, list) {
+		teadfs_stats_inc(item->sb, rc ? TS_SEND_DROP : TS_NOTIFY_EVENT);
+		list_del(&item->list);
+		teadfs_free(item);
 	}
 	if (buffer_packet) {
 		teadfs_free(buffer_packet);
@@ -306,9 +1022,186 @@ int teadfs_request_release(char* file_path_start, int file_path_size, struct fil
 	return rc;
 }
 
+/**
+ * teadfs_notify_work
+ *
+ * Sends the queued notifies in order. The workqueue is ordered, so
+ * notifies of one inode reach user mode in the order they were queued.
+ * Adjacent events of the same session are batched into one PR_MSG_EVENT.
+ */
+static void teadfs_notify_work(struct work_struct* work) {
+	LIST_HEAD(item_list);
+	LIST_HEAD(batch);
+	int batch_count = 0;
+	size_t batch_size = 0;
+	size_t record_size;
+	struct teadfs_session* batch_session = NULL;
+	struct teadfs_notify_item* item, *tmp;
+
+	LOG_DBG("ENTRY\n");
+	spin_lock(&teadfs_notify_queue.lock);
+	list_splice_init(&teadfs_notify_queue.item_list, &item_list);
+	teadfs_notify_queue.event_count = 0;
+	spin_unlock(&teadfs_notify_queue.lock);
+
+	list_for_each_entry_safe(item, tmp, &item_list, list) {
+		list_del(&item->list);
+		if (PR_MSG_EVENT == item->msg_type) {
+			record_size = teadfs_event_record_size(item);
+			if (batch_count && ((batch_size + record_size > TEADFS_EVENT_BATCH_SIZE)
+				|| (batch_session != teadfs_sb_session(item->sb)))) {
+				teadfs_send_events(batch_session, &batch, batch_count, batch_size);
+				batch_count = 0;
+				batch_size = 0;
+			}
+			batch_session = teadfs_sb_session(item->sb);
+			list_add_tail(&item->list, &batch);
+			batch_count++;
+			batch_size += record_size;
+			continue;
+		}
+		//events queued before this notify go first
+		if (batch_count) {
+			teadfs_send_events(batch_session, &batch, batch_count, batch_size);
+			batch_count = 0;
+			batch_size = 0;
+		}
+		switch (item->msg_type) {
+		case PR_MSG_RELEASE:
+			teadfs_send_release(item);
+			break;
+		default:
+			break;
+		}
+		teadfs_free(item);
+	}
+	if (batch_count) {
+		teadfs_send_events(batch_session, &batch, batch_count, batch_size);
+	}
+	LOG_DBG("LEVAL\n");
+}
+
+int teadfs_init_user_com(void) {
+	int rc = 0;
+
+	LOG_DBG("ENTRY\n");
+	do {
+		spin_lock_init(&teadfs_notify_queue.lock);
+		INIT_LIST_HEAD(&teadfs_notify_queue.item_list);
+		INIT_WORK(&teadfs_notify_queue.work, teadfs_notify_work);
+		teadfs_notify_queue.wq = alloc_ordered_workqueue("teadfs_notify", 0);
+		if (!teadfs_notify_queue.wq) {
+			rc = -ENOMEM;
+			break;
+		}
+	} while (0);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+void teadfs_flush_user_com(void) {
+	if (teadfs_notify_queue.wq) {
+		flush_workqueue(teadfs_notify_queue.wq);
+	}
+}
+
+void teadfs_release_user_com(void) {
+	LOG_DBG("ENTRY\n");
+	if (teadfs_notify_queue.wq) {
+		flush_workqueue(teadfs_notify_queue.wq);
+		destroy_workqueue(teadfs_notify_queue.wq);
+		teadfs_notify_queue.wq = NULL;
+	}
+	LOG_DBG("LEVAL\n");
+}
+
+//close file to user mode
+int teadfs_request_release(char* file_path_start, int file_path_size, struct file* file) {
+	int rc = 0;
+	pid_t kpid = 0;
+	struct teadfs_notify_item* item = NULL;
+	struct teadfs_session* session;
+	struct teadfs_file_name name;
+
+	LOG_DBG("ENTRY\n");
+	memset(&name, 0, sizeof(struct teadfs_file_name));
+	do {
+		if (!(file) || !(file->f_path.dentry) || !(file->f_path.mnt)) {
+			LOG_ERR("error file\n");
+			rc = -ENOMEM;
+			break;
+		}
+		session = teadfs_sb_session(file_inode(file)->i_sb);
+		if (!teadfs_notify_queue.wq || !teadfs_get_client_connect(session)) {
+			rc = -ENOMEM;
+			break;
+		}
+		//get current process id
+		kpid = task_tgid_vnr(current);
+		//ignore client proces
+		if (kpid == teadfs_get_client_pid(session)) {
+			rc = -ENOMEM;
+			break;
+		}
+		//opened without a path for a daemon naming files by identity
+		if (!file_path_start || (teadfs_get_client_features(session) & PR_HELLO_IDENTITY)) {
+			rc = teadfs_get_file_name(session, file->f_path.dentry, 0, &name);
+			if (rc) {
+				break;
+			}
+		} else {
+			name.file_path = file_path_start;
+			name.file_path_size = file_path_size;
+		}
+		LOG_INF("%.*s\n", name.file_path_size, name.file_path);
+		//file path is released with the file, so copy it
+		item = teadfs_zalloc(sizeof(struct teadfs_notify_item) + name.file_path_size + name.dir_path_size, GFP_KERNEL);
+		if (!item) {
+			rc = -ENOMEM;
+			break;
+		}
+		item->msg_type = PR_MSG_RELEASE;
+		item->pid = kpid;
+		item->file_id = teadfs_file_to_private(file)->file_id;
+		item->ino = file_inode(file)->i_ino;
+		item->sb = file_inode(file)->i_sb;
+		item->file_path_size = name.file_path_size;
+		memcpy(item->file_path, name.file_path, name.file_path_size);
+		item->identity = name.identity;
+		item->new_file_path_size = name.dir_path_size;
+		memcpy(item->file_path + name.file_path_size, name.dir_path, name.dir_path_size);
+		//the item puts it
+		item->dir = name.dir;
+		item->dir_epoch = name.dir_epoch;
+		name.dir = NULL;
+		//granted to the daemon when the release is sent, put then
+		if (S_ISREG(file_inode(file)->i_mode)) {
+			teadfs_get_lower_path(file->f_path.dentry, &item->lower_path);
+			path_get(&item->lower_path);
+		}
+
+		spin_lock(&teadfs_notify_queue.lock);
+		list_add_tail(&item->list, &teadfs_notify_queue.item_list);
+		spin_unlock(&teadfs_notify_queue.lock);
+		queue_work(teadfs_notify_queue.wq, &teadfs_notify_queue.work);
+	} while (0);
+	teadfs_put_file_name(&name);
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+
+//format 2 layout of the file, read from its label at open
+static void teadfs_packet_extent(struct inode* inode, __u8* extent_shift, __u8* iv_seed) {
+	struct teadfs_inode_info* inode_info = teadfs_inode_to_private(inode);
+
+	*extent_shift = inode_info->extent_shift;
+	if (*extent_shift)
+		memcpy(iv_seed, inode_info->iv_seed, TEADFS_IV_SEED_SIZE);
+}
 
 //close file to user mode
-int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size) {
+int teadfs_request_read(struct inode* inode, loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size) {
 	int rc = 0;
 	int buffer_size = 0;
 	char *buffer = NULL;
@@ -316,17 +1209,18 @@ int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char*
 	struct teadfs_packet_info* packet = NULL;
 	char* response_data = NULL;
 	size_t response_size = 0;
+	struct teadfs_session* session = teadfs_sb_session(inode ? inode->i_sb : NULL);
 
 	LOG_DBG("ENTRY\n");
 	do {
-		if (!teadfs_get_client_connect()) {
+		if (!teadfs_get_client_connect(session)) {
 			rc = -ENOMEM;
 			break;
 		}
 		//get current process id
 		kpid = task_tgid_vnr(current);
 		//ignore client proces
-		if (kpid == teadfs_get_client_pid()) {
+		if (kpid == teadfs_get_client_pid(session)) {
 			rc = -ENOMEM;
 			break;
 		}
@@ -343,6 +1237,8 @@ int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char*
 
 		packet->data.read.offset = offset;
 		packet->data.read.code = 0;
+		teadfs_packet_extent(inode, &packet->data.read.extent_shift, packet->data.read.iv_seed);
+		packet->data.read.compress = teadfs_inode_to_private(inode)->extent_compress;
 		packet->data.read.read_data.size = src_size;
 		packet->data.read.read_data.offset = sizeof(struct teadfs_packet_info);
 		memcpy(buffer + sizeof(struct teadfs_packet_info), src_data, src_size);
@@ -356,7 +1252,7 @@ int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char*
 			, packet->header.gid
 		);
 		//send to usr
-		rc = teadfs_request_send(packet->header.msg_id, buffer_size, buffer, &response_size, &response_data);
+		rc = teadfs_request_send(inode, packet->header.msg_id, buffer_size, buffer, &response_size, &response_data);
 		if (rc) {
 			LOG_ERR("teadfs_request_send, error:%d\n", rc);
 			rc = -ENOMEM;
@@ -385,13 +1281,22 @@ int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char*
 			rc = -ENOMEM;
 			break;
 		}
+		//extents are transformed in place
+		if (teadfs_inode_to_private(inode)->extent_shift && src_size != packet->data.read.read_data.size) {
+			rc = -EIO;
+			break;
+		}
 		memcpy(dst_data, (char*)packet + packet->data.read.read_data.offset, packet->data.read.read_data.size);
 		rc = packet->data.read.read_data.size;
+		teadfs_stats_add(inode->i_sb, TS_BYTES_READ, src_size);
 	} while (0);
 	//release mem
 	if (response_data) {
 		teadfs_free(response_data);
 	}
+	if (buffer) {
+		teadfs_free(buffer);
+	}
 
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
@@ -399,7 +1304,7 @@ int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char*
 
 
 //close file to user mode
-int teadfs_request_write(loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size) {
+int teadfs_request_write_extent(struct inode* inode, loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size, int compress) {
 	int rc = 0;
 	int buffer_size = 0;
 	char* buffer = NULL;
@@ -407,17 +1312,18 @@ int teadfs_request_write(loff_t offset, const char* src_data, int src_size, char
 	struct teadfs_packet_info* packet = NULL;
 	char* response_data = NULL;
 	size_t response_size = 0;
+	struct teadfs_session* session = teadfs_sb_session(inode ? inode->i_sb : NULL);
 
 	LOG_DBG("ENTRY\n");
 	do {
-		if (!teadfs_get_client_connect()) {
+		if (!teadfs_get_client_connect(session)) {
 			rc = -ENOMEM;
 			break;
 		}
 		//get current process id
 		kpid = task_tgid_vnr(current);
 		//ignore client proces
-		if (kpid == teadfs_get_client_pid()) {
+		if (kpid == teadfs_get_client_pid(session)) {
 			rc = -ENOMEM;
 			break;
 		}
@@ -434,6 +1340,8 @@ int teadfs_request_write(loff_t offset, const char* src_data, int src_size, char
 
 		packet->data.write.offset = offset;
 		packet->data.write.code = 0;
+		teadfs_packet_extent(inode, &packet->data.write.extent_shift, packet->data.write.iv_seed);
+		packet->data.write.compress = compress;
 		packet->data.write.write_data.size = src_size;
 		packet->data.write.write_data.offset = sizeof(struct teadfs_packet_info);
 		memcpy(buffer + sizeof(struct teadfs_packet_info), src_data, src_size);
@@ -447,7 +1355,7 @@ int teadfs_request_write(loff_t offset, const char* src_data, int src_size, char
 			, packet->header.gid
 		);
 		//send to usr
-		rc = teadfs_request_send(packet->header.msg_id, buffer_size, buffer, &response_size, &response_data);
+		rc = teadfs_request_send(inode, packet->header.msg_id, buffer_size, buffer, &response_size, &response_data);
 		if (rc) {
 			rc = -ENOMEM;
 			break;
@@ -472,19 +1380,288 @@ int teadfs_request_write(loff_t offset, const char* src_data, int src_size, char
 			rc = -ENOMEM;
 			break;
 		}
-		memcpy(dst_data, (char*)packet + packet->data.write.write_data.offset, packet->data.write.write_data.size);
-		//release mem
-		if (response_data) {
-			teadfs_free(response_data);
+		//extents are transformed in place, unless stored compressed
+		if (teadfs_inode_to_private(inode)->extent_shift
+			&& (compress ? src_size < packet->data.write.write_data.size : src_size != packet->data.write.write_data.size)) {
+			rc = -EIO;
+			break;
 		}
+		memcpy(dst_data, (char*)packet + packet->data.write.write_data.offset, packet->data.write.write_data.size);
 		rc = packet->data.write.write_data.size;
+		teadfs_stats_add(inode->i_sb, TS_BYTES_WRITE, src_size);
 	} while (0);
+	//release mem
+	if (response_data) {
+		teadfs_free(response_data);
+	}
+	if (buffer) {
+		teadfs_free(buffer);
+	}
 
 	LOG_DBG("LEVAL rc : [%d]\n", rc);
 	return rc;
 }
 
-//delete file
-int teadfs_request_delete(struct dentry* dentry) {
-	return 0;
-}
\ No newline at end of file
+int teadfs_request_write(struct inode* inode, loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size) {
+	return teadfs_request_write_extent(inode, offset, src_data, src_size, dst_data, dst_size, 0);
+}
+
+static size_t teadfs_stat_record_size(int file_path_size) {
+	return ALIGN(sizeof(struct teadfs_stat_record) + file_path_size, 8);
+}
+
+/**
+ * teadfs_request_stat
+ * @sb: The teadfs super block of the files
+ * @entries: Files to resolve, answers are stored in place
+ * @count: Number of @entries
+ *
+ * Sends one PR_MSG_STAT for a readdirplus chunk. User mode answers
+ * every record of the packet in place.
+ *
+ * Returns zero on success; non-zero otherwise
+ */
+int teadfs_request_stat(struct super_block* sb, struct teadfs_stat_entry* entries, int count) {
+	int rc = 0;
+	int i;
+	char* path_buf = NULL;
+	char** paths = NULL;
+	int* path_sizes = NULL;
+	char* buffer = NULL;
+	int buffer_size = 0;
+	pid_t kpid = 0;
+	struct teadfs_packet_info* packet = NULL;
+	struct teadfs_stat_record* record = NULL;
+	char* response_data = NULL;
+	size_t response_size = 0;
+	size_t offset;
+	struct teadfs_session* session = teadfs_sb_session(sb);
+
+	LOG_DBG("ENTRY count:%d\n", count);
+	do {
+		if (!teadfs_get_client_connect(session)) {
+			rc = -ENOMEM;
+			break;
+		}
+		kpid = task_tgid_vnr(current);
+		//client process listing a directory would wait for itself
+		if (kpid == teadfs_get_client_pid(session)) {
+			rc = -ENOMEM;
+			break;
+		}
+		path_buf = teadfs_zalloc(PATH_MAX, GFP_KERNEL);
+		paths = teadfs_zalloc(count * sizeof(char*), GFP_KERNEL);
+		path_sizes = teadfs_zalloc(count * sizeof(int), GFP_KERNEL);
+		if (!path_buf || !paths || !path_sizes) {
+			rc = -ENOMEM;
+			break;
+		}
+		//copy paths out, d_path fills the buffer from its end
+		buffer_size = sizeof(struct teadfs_packet_info);
+		for (i = 0; i < count; i++) {
+			struct path lower_path;
+			char* path;
+
+			//lower paths, as events, open and release carry
+			teadfs_get_lower_path(entries[i].path.dentry, &lower_path);
+			path = d_path(&lower_path, path_buf, PATH_MAX);
+			teadfs_put_lower_path(entries[i].path.dentry, &lower_path);
+			if (IS_ERR(path)) {
+				rc = PTR_ERR(path);
+				break;
+			}
+			path_sizes[i] = strlen(path);
+			paths[i] = kstrdup(path, GFP_KERNEL);
+			if (!paths[i]) {
+				rc = -ENOMEM;
+				break;
+			}
+			buffer_size += teadfs_stat_record_size(path_sizes[i]);
+		}
+		if (rc)
+			break;
+		buffer = teadfs_zalloc(buffer_size, GFP_KERNEL);
+		if (!buffer) {
+			rc = -ENOMEM;
+			break;
+		}
+		packet = (struct teadfs_packet_info*)buffer;
+		teadfs_packet_header(packet, buffer_size, PR_MSG_STAT, 0, kpid, KUIDT_INIT(0), KGIDT_INIT(0));
+		packet->data.stat.count = count;
+		packet->data.stat.stats.size = buffer_size - sizeof(struct teadfs_packet_info);
+		packet->data.stat.stats.offset = sizeof(struct teadfs_packet_info);
+		record = (struct teadfs_stat_record*)(buffer + sizeof(struct teadfs_packet_info));
+		for (i = 0; i < count; i++) {
+			record->size = teadfs_stat_record_size(path_sizes[i]);
+			record->access = OFR_INIT;
+			record->ino = entries[i].inode->i_ino;
+			record->lower_size = entries[i].lower_size;
+			record->plain_size = -1;
+			record->file_path.size = path_sizes[i];
+			record->file_path.offset = sizeof(struct teadfs_stat_record);
+			memcpy((char*)record + record->file_path.offset, paths[i], path_sizes[i]);
+			record = (struct teadfs_stat_record*)((char*)record + record->size);
+		}
+		rc = teadfs_request_send(entries[0].inode, packet->header.msg_id, buffer_size, buffer, &response_size, &response_data);
+		if (rc) {
+			rc = -ENOMEM;
+			break;
+		}
+		//answered in place, same layout
+		if (!response_data || response_size != buffer_size) {
+			LOG_ERR("Get Message Size Error, size:%d\n", response_size);
+			rc = -ENOMEM;
+			break;
+		}
+		offset = sizeof(struct teadfs_packet_info);
+		for (i = 0; i < count; i++) {
+			record = (struct teadfs_stat_record*)(response_data + offset);
+			entries[i].access = record->access;
+			entries[i].plain_size = record->plain_size;
+			teadfs_stats_verdict(sb, record->access);
+			offset += teadfs_stat_record_size(path_sizes[i]);
+		}
+	} while (0);
+	if (paths) {
+		for (i = 0; i < count; i++) {
+			kfree(paths[i]);
+		}
+		teadfs_free(paths);
+	}
+	if (path_sizes) {
+		teadfs_free(path_sizes);
+	}
+	if (path_buf) {
+		teadfs_free(path_buf);
+	}
+	if (response_data) {
+		teadfs_free(response_data);
+	}
+	if (buffer) {
+		teadfs_free(buffer);
+	}
+	LOG_DBG("LEVAL rc : [%d]\n", rc);
+	return rc;
+}
+
+struct teadfs_notify_item* teadfs_event_prepare(__u32 event, struct inode* inode, struct path* path, struct path* new_path) {
+	char* buffer_path = NULL;
+	char* file_path_start = NULL;
+	char* new_file_path_start = NULL;
+	int file_path_size = 0;
+	int new_file_path_size = 0;
+	pid_t kpid = 0;
+	struct teadfs_notify_item* item = NULL;
+	struct teadfs_session* session = teadfs_sb_session(inode ? inode->i_sb : NULL);
+
+	LOG_DBG("ENTRY event:%u\n", event);
+	//the file changed, the daemon may answer its opens differently now
+	if (inode) {
+		teadfs_drop_open_verdicts(inode);
+	}
+	do {
+		if (!teadfs_notify_queue.wq || !teadfs_get_client_connect(session)) {
+			break;
+		}
+		//get current process id
+		kpid = task_tgid_vnr(current);
+		//ignore client proces, it knows what it did
+		if (kpid == teadfs_get_client_pid(session)) {
+			break;
+		}
+		buffer_path = teadfs_zalloc(PATH_MAX * 2, GFP_KERNEL);
+		if (!buffer_path) {
+			break;
+		}
+		file_path_start = d_path(path, buffer_path, PATH_MAX);
+		if (IS_ERR(file_path_start)) {
+			break;
+		}
+		file_path_size = strlen(file_path_start);
+		if (new_path) {
+			new_file_path_start = d_path(new_path, buffer_path + PATH_MAX, PATH_MAX);
+			if (IS_ERR(new_file_path_start)) {
+				break;
+			}
+			new_file_path_size = strlen(new_file_path_start);
+		}
+		item = teadfs_zalloc(sizeof(struct teadfs_notify_item) + file_path_size + new_file_path_size, GFP_KERNEL);
+		if (!item) {
+			break;
+		}
+		item->msg_type = PR_MSG_EVENT;
+		item->pid = kpid;
+		item->event = event;
+		item->ino = inode ? inode->i_ino : 0;
+		item->sb = inode ? inode->i_sb : NULL;
+		item->file_path_size = file_path_size;
+		item->new_file_path_size = new_file_path_size;
+		memcpy(item->file_path, file_path_start, file_path_size);
+		if (new_file_path_size) {
+			memcpy(item->file_path + file_path_size, new_file_path_start, new_file_path_size);
+		}
+	} while (0);
+	if (buffer_path) {
+		teadfs_free(buffer_path);
+	}
+	LOG_DBG("LEVAL item:%px\n", item);
+	return item;
+}
+
+/**
+ * teadfs_event_commit
+ * @item: event from teadfs_event_prepare
+ *
+ * Queues the event without waiting for user mode. A write or truncate
+ * event is dropped when the latest queued notify of the same file is the
+ * same event, user mode learns nothing new from the second one.
+ */
+void teadfs_event_commit(struct teadfs_notify_item* item) {
+	struct teadfs_notify_item* iter;
+	int drop = 0;
+
+	if (!item) {
+		return;
+	}
+	spin_lock(&teadfs_notify_queue.lock);
+	do {
+		if (TET_WRITE == item->event || TET_TRUNCATE == item->event) {
+			list_for_each_entry_reverse(iter, &teadfs_notify_queue.item_list, list) {
+				if (iter->ino != item->ino || iter->file_path_size != item->file_path_size
+					|| memcmp(iter->file_path, item->file_path, item->file_path_size)) {
+					continue;
+				}
+				drop = (PR_MSG_EVENT == iter->msg_type && iter->event == item->event);
+				break;
+			}
+		}
+		if (drop) {
+			break;
+		}
+		if (teadfs_notify_queue.event_count >= TEADFS_NOTIFY_MAX_EVENTS) {
+			LOG_ERR("too many events queued, drop event:%u\n", item->event);
+			teadfs_stats_inc(item->sb, TS_NOTIFY_DROP);
+			drop = 1;
+			break;
+		}
+		teadfs_notify_queue.event_count++;
+		list_add_tail(&item->list, &teadfs_notify_queue.item_list);
+	} while (0);
+	spin_unlock(&teadfs_notify_queue.lock);
+
+	if (drop) {
+		teadfs_free(item);
+	} else {
+		queue_work(teadfs_notify_queue.wq, &teadfs_notify_queue.work);
+	}
+}
+
+void teadfs_event_cancel(struct teadfs_notify_item* item) {
+	if (item) {
+		teadfs_free(item);
+	}
+}
+
+void teadfs_notify_event(__u32 event, struct inode* inode, struct path* path, struct path* new_path) {
+	teadfs_event_commit(teadfs_event_prepare(event, inode, path, new_path));
+}
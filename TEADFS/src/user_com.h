@@ -5,21 +5,64 @@
 
 #include <linux/fs.h>
 
+//init release notify queue
+int teadfs_init_user_com(void);
+
+//wait queued notifies sent, and release
+void teadfs_release_user_com(void);
+
+//wait queued notifies sent
+void teadfs_flush_user_com(void);
+
 //open file to user mode
 int teadfs_request_open_file(struct file* file, struct teadfs_file_info* file_info);
-int teadfs_request_open_path(struct path* path);
+int teadfs_request_open_path(struct inode* inode, struct dentry* dentry, struct path* path);
 
-//close file to user mode
+//drop cached open verdicts of an inode being evicted, released or changed
+void teadfs_drop_open_verdicts(struct inode* inode);
+
+//empty window of upcalls in flight, see teadfs_sb_info
+void teadfs_upcall_window_init(struct teadfs_upcall_window* window);
+
+//close file to user mode. queued, and sent one-way by notify worker
 int teadfs_request_release(char* file_path_start, int file_path_size, struct file* file);
 
 //read file to user mode
-int teadfs_request_read(loff_t offset, const char* src_data, int src_size, char *dst_data, int dst_size);
+int teadfs_request_read(struct inode* inode, loff_t offset, const char* src_data, int src_size, char *dst_data, int dst_size);
 
 //write file to user mode
-int teadfs_request_write(loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size);
+int teadfs_request_write(struct inode* inode, loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size);
+
+//write one whole extent of a format 3 file, compress lets user mode store it in fewer bytes
+int teadfs_request_write_extent(struct inode* inode, loff_t offset, const char* src_data, int src_size, char* dst_data, int dst_size, int compress);
+
+/* one file of a readdirplus chunk */
+struct teadfs_stat_entry {
+	struct inode* inode;
+	//upper path, the path user mode sees
+	struct path path;
+	loff_t lower_size;
+	//answer: OPEN_FILE_RESULT, plaintext size or -1
+	int access;
+	loff_t plain_size;
+};
+
+//verdicts and plaintext sizes of count files in one upcall
+int teadfs_request_stat(struct super_block* sb, struct teadfs_stat_entry* entries, int count);
+
+struct teadfs_notify_item;
+
+//build file event before the operation, paths may change after it. NULL if not need send
+struct teadfs_notify_item* teadfs_event_prepare(__u32 event, struct inode* inode, struct path* path, struct path* new_path);
+
+//queue prepared event to user mode, one-way. NULL is ignored
+void teadfs_event_commit(struct teadfs_notify_item* item);
+
+//operation failed, drop prepared event. NULL is ignored
+void teadfs_event_cancel(struct teadfs_notify_item* item);
 
-//delete file
-int teadfs_request_delete(struct dentry* dentry);
+//prepare and commit
+void teadfs_notify_event(__u32 event, struct inode* inode, struct path* path, struct path* new_path);
 #endif
 
 
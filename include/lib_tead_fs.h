@@ -20,14 +20,66 @@
 		TRFR_COUNT
 	};
 
+	enum TEADFS_EVENT {
+		TE_UNLINK = 1, // file deleted
+		TE_RENAME, // file renamed to pszNewFilePath
+		TE_TRUNCATE, // file size changed
+		TE_WRITE, // first write after open
+
+		TE_COUNT
+	};
+
+	// format 3 file, the extent slot may hold what compress_extent stored
+	#define TEADFS_EXTENT_COMPRESSED 0x01
+
+	// TEAFS_DEAL_CB u32Options
+	// name files by lower identity and an interned directory: open and release get lower paths
+	// rebuilt here, the kernel resolves a directory path only the first time it is used
+	#define TEADFS_OPTION_IDENTITY 0x01
+
+	// one extent of a format 2 or 3 file
+	struct TEADFS_EXTENT {
+		uint64_t u64Extent; // extent index in the file
+		uint32_t u32ExtentSize;
+		uint32_t u32Offset; // data offset in the extent
+		const unsigned char* pIVSeed; // iv_seed of the file label, 16 bytes
+		uint32_t u32Flags; // TEADFS_EXTENT_*
+	};
+
+	// every path handed to the callbacks below is the lower file's path
 	struct TEAFS_DEAL_CB {
 		int (*open)(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath);
 		int (*release)(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath);
 		int (*read)(uint64_t offset, uint32_t u32SrcSize, char *pSrcData, uint32_t *u32DstSize, char* pDstData);
 		int (*write)(uint64_t offset, uint32_t u32SrcSize, char* pSrcData, uint32_t* u32DstSize, char* pDstData);
 		int (*cleanup)(uint64_t u64FileId);
+		// one-way file event, kernel does not wait. pszNewFilePath is empty except rename
+		int (*event)(uint32_t u32Event, uint64_t u64Ino, char* pszFilePath, char* pszNewFilePath);
+		// verdict of a listed file for stat, readdirplus mount option. set *pi64PlainSize or leave -1
+		// to derive it from the header. when not set the files are left to getattr
+		int (*stat)(uint64_t u64Ino, uint32_t u32PID, char* pszFilePath, int64_t i64LowerSize, int64_t* pi64PlainSize);
+		// format 2 files, called for each extent, several at once on different threads. u32Size bytes
+		// of pDstData are set, the transform keeps the size. read and write are used when not set
+		int (*read_extent)(const struct TEADFS_EXTENT* pExtent, uint32_t u32Size, char* pSrcData, char* pDstData);
+		int (*write_extent)(const struct TEADFS_EXTENT* pExtent, uint32_t u32Size, char* pSrcData, char* pDstData);
+		// format 3 files, a whole extent that may be stored compressed then encrypted in *pu32DstSize bytes,
+		// at most u32Size. read_extent gets the slot back with zeros after the stored bytes, and must tell
+		// a compressed slot from one stored by write_extent. write_extent is used when not set
+		int (*compress_extent)(const struct TEADFS_EXTENT* pExtent, uint32_t u32Size, char* pSrcData, uint32_t* pu32DstSize, char* pDstData);
+		// open with the label the kernel read, u32HeaderSize below ENCRYPT_FILE_HEADER_SIZE when the file
+		// is shorter than a label. open is used when not set or when the kernel could not read it
+		int (*open_header)(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath, const char* pHeader, uint32_t u32HeaderSize);
+		// with either set the kernel opens the lower file in this process for the call: read-only for
+		// open_fd, read-write for release_fd. nFd is -1 when it could not, and is closed after the call.
+		// open_header goes first when the label came with the open. open and release are used when not set
+		int (*open_fd)(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath, int nFd);
+		int (*release_fd)(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath, int nFd);
+		// TEADFS_OPTION_*
+		uint32_t u32Options;
 	};
 	//start and connect fs
 	int StartTEADFS(struct TEAFS_DEAL_CB cb);
+	//serve only the mounts with session=u32Session. one daemon per session
+	int StartTEADFSSession(struct TEAFS_DEAL_CB cb, uint32_t u32Session);
 	
 #endif //LIB_TEAD_FS_H
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include <linux/limits.h>
 #include <sys/stat.h>
 #include <utime.h>
+#include <inttypes.h>
 
 
 #define ENCRYPT_FILE_FLAG 0x44414554
@@ -46,10 +47,26 @@ std::string GetFileName(std::string strPath) {
 
 
 
+//verdict from the label
+TEADFS_OPEN_RESULT GetOpenResult(uint32_t u32PID, const char* pHeader, int nSize) {
+	TEADFS_OPEN_RESULT result = TOR_INIT;
+	if (nSize < ENCRYPT_FILE_HEADER_SIZE) {
+		return result;
+	}
+	if (ENCRYPT_FILE_FLAG == *(uint32_t*)pHeader) {
+		std::string strProcPath = GetProcPath(u32PID);
+		if (std::string::npos != strProcPath.find("cat")) {
+			result = TOR_ENCRYPT;
+		} else {
+			result = TOR_DECRYPT;
+		}
+	}
+	return result;
+}
+
 int open(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath) {
 	
-	printf("[open] file id:%0xllx, pid:%d path:%s\n", u64FileId, u32PID, pszFilePath);
-	std::string strProcPath = GetProcPath(u32PID);
+	printf("[open] file id:0x%" PRIx64 ", pid:%d path:%s\n", u64FileId, u32PID, pszFilePath);
 
 
 
@@ -63,16 +80,7 @@ int open(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath) {
 		}
 		int nRead = read(fdSrc, chHeader, ENCRYPT_FILE_HEADER_SIZE);
 		
-		if (nRead < ENCRYPT_FILE_HEADER_SIZE) {
-			break;
-		}
-		if (ENCRYPT_FILE_FLAG == *(uint32_t*)chHeader) {
-			if (std::string::npos != strProcPath.find("cat")) {
-				result = TOR_ENCRYPT;
-			} else {
-				result = TOR_DECRYPT;
-			}
-		}
+		result = GetOpenResult(u32PID, chHeader, nRead);
 	} while (0);
 	if (fdSrc > 0) {
 		close(fdSrc);
@@ -80,70 +88,114 @@ int open(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath) {
 	printf("[open] result:%d\n", result);
 	return result;
 }
-int release(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath) {
-	printf("[release] file id:%0xllx, pid:%d path:%s\n", u64FileId, u32PID, pszFilePath);
+
+int open_header(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath, const char* pHeader, uint32_t u32HeaderSize) {
+	printf("[open_header] file id:0x%" PRIx64 ", pid:%d path:%s header size:%u\n", u64FileId, u32PID, pszFilePath, u32HeaderSize);
+	TEADFS_OPEN_RESULT result = GetOpenResult(u32PID, pHeader, u32HeaderSize);
+	printf("[open_header] result:%d\n", result);
+	return result;
+}
+//label the file read from fdSrc, through a temp file renamed over pszFilePath.
+//the file only changes by the rename, a failure part way leaves it as it was
+void LabelFile(int fdSrc, char* pszFilePath) {
 	char chBuf[1024];
 	int nRead = 0;
 	char chHeader[ENCRYPT_FILE_HEADER_SIZE] = { 0 };
 	int nFlag = ENCRYPT_FILE_FLAG;
+	bool bOk = true;
 
-	std::string strFilePath = pszFilePath;
-	std::string strFileName = GetFileName(strFilePath);
-	if (std::string::npos == strFilePath.find(".txt")) {
-		return TRFR_NORMAL;
-	}
-
-	//create file
-	int fdSrc = open(pszFilePath, O_RDONLY);
-	if (fdSrc < 0) {
-		return TRFR_NORMAL;
-	}
 	nRead = pread(fdSrc, chHeader, ENCRYPT_FILE_HEADER_SIZE, 0);
 	if (nRead >= ENCRYPT_FILE_HEADER_SIZE) {
 		if (ENCRYPT_FILE_FLAG == *(uint32_t*)chHeader) {
-			return TRFR_NORMAL;
+			return;
 		}
 	}
 	std::string strTmpPath = pszFilePath;
 	strTmpPath += ".teadfstmp";
-	int fdDst = open(strTmpPath.c_str(), O_RDWR | O_CREAT);
+	int fdDst = open(strTmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
 	if (fdDst < 0) {
-		return TRFR_NORMAL;
+		return;
 	}
 	//write header
+	memset(chHeader, 0, ENCRYPT_FILE_HEADER_SIZE);
 	memcpy(chHeader, &nFlag, sizeof(nFlag));
-	write(fdDst, chHeader, ENCRYPT_FILE_HEADER_SIZE);
-	do {
-		nRead = read(fdSrc, chBuf, 1024);
+	if (write(fdDst, chHeader, ENCRYPT_FILE_HEADER_SIZE) != ENCRYPT_FILE_HEADER_SIZE) {
+		bOk = false;
+	}
+	off_t nOffset = 0;
+	while (bOk) {
+		nRead = pread(fdSrc, chBuf, 1024, nOffset);
+		if (nRead < 0) {
+			bOk = false;
+		}
 		if (nRead <= 0) {
 			break;
 		}
 		for (int i = 0; i < nRead; i++) {
 			chBuf[i] = chBuf[i] ^ 0x13;
 		}
-		write(fdDst, chBuf, nRead);
-	} while (1);
-
+		if (write(fdDst, chBuf, nRead) != nRead) {
+			bOk = false;
+		}
+		nOffset += nRead;
+	}
 
 	struct stat stat = { 0 };
-	fstat(fdSrc, &stat);
-	fchmod(fdDst, stat.st_mode);
-	
-	fchown(fdDst, stat.st_uid, stat.st_gid);
-	struct timespec times[2] = { 0 };
-
-	times[0] = stat.st_atim;
-	times[1] = stat.st_mtim;
-	futimens(fdDst, times);
+	if (bOk && fstat(fdSrc, &stat) < 0) {
+		bOk = false;
+	}
+	if (bOk) {
+		fchmod(fdDst, stat.st_mode);
+
+		fchown(fdDst, stat.st_uid, stat.st_gid);
+		struct timespec times[2] = { 0 };
+
+		times[0] = stat.st_atim;
+		times[1] = stat.st_mtim;
+		futimens(fdDst, times);
+		//the data is on disk before the name points at it
+		if (fsync(fdDst) < 0) {
+			bOk = false;
+		}
+	}
+	close(fdDst);
+	if (!bOk || rename(strTmpPath.c_str(), pszFilePath) < 0) {
+		unlink(strTmpPath.c_str());
+	}
+}
 
+int release(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath) {
+	printf("[release] file id:0x%" PRIx64 ", pid:%d path:%s\n", u64FileId, u32PID, pszFilePath);
+	std::string strFilePath = pszFilePath;
+	if (std::string::npos == strFilePath.find(".txt")) {
+		return TRFR_NORMAL;
+	}
 
-	close(fdDst);
+	//the lower path of the file
+	int fdSrc = open(pszFilePath, O_RDONLY);
+	if (fdSrc < 0) {
+		return TRFR_NORMAL;
+	}
+	LabelFile(fdSrc, pszFilePath);
 	close(fdSrc);
-	rename(strTmpPath.c_str(), pszFilePath);
+	return TRFR_NORMAL;
+}
+
+int release_fd(uint64_t u64FileId, uint32_t u32PID, char* pszFilePath, int nFd) {
+	printf("[release_fd] file id:0x%" PRIx64 ", pid:%d path:%s fd:%d\n", u64FileId, u32PID, pszFilePath, nFd);
+	std::string strFilePath = pszFilePath;
+	if (std::string::npos == strFilePath.find(".txt")) {
+		return TRFR_NORMAL;
+	}
+	//the kernel could not open it for us, label it by its path
+	if (nFd < 0) {
+		return release(u64FileId, u32PID, pszFilePath);
+	}
+	LabelFile(nFd, pszFilePath);
 	return TRFR_NORMAL;
 }
 int read(uint64_t offset, uint32_t u32SrcSize, char* pSrcData, uint32_t* u32DstSize, char* pDstData) {
-	printf("[read] offset:%lld, size :%d\n", offset, u32SrcSize);
+	printf("[read] offset:%" PRIu64 ", size :%d\n", offset, u32SrcSize);
 	for (int i = 0; i < u32SrcSize; i++) {
 		pDstData[i] = pSrcData[i] ^ 0x13;
 	}
@@ -153,7 +205,7 @@ int read(uint64_t offset, uint32_t u32SrcSize, char* pSrcData, uint32_t* u32DstS
 }
 
 int write(uint64_t offset,  uint32_t u32SrcSize, char* pSrcData, uint32_t* u32DstSize, char* pDstData) {
-	printf("[write]  offset:%lld, size :%d\n", offset, u32SrcSize);
+	printf("[write]  offset:%" PRIu64 ", size :%d\n", offset, u32SrcSize);
 	for (int i = 0; i < u32SrcSize; i++) {
 		pDstData[i] = pSrcData[i] ^ 0x13;
 	}
@@ -166,6 +218,11 @@ int cleanup(uint64_t u64FileId) {
 
 }
 
+int event(uint32_t u32Event, uint64_t u64Ino, char* pszFilePath, char* pszNewFilePath) {
+	printf("[event] event:%d, ino:%" PRIu64 " path:%s new path:%s\n", u32Event, u64Ino, pszFilePath, pszNewFilePath);
+	return 0;
+}
+
 
 
 
@@ -195,6 +252,10 @@ int main(int argc, char *argv[]) {
 		, .read = read
 		, .write = write
 		, .cleanup = cleanup
+		, .event = event
+		, .open_header = open_header
+		, .release_fd = release_fd
+		, .u32Options = TEADFS_OPTION_IDENTITY
 	};
 	StartTEADFS(cb);
 